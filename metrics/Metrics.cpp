@@ -0,0 +1,142 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "Metrics.h"
+
+#include <cstdio>
+
+namespace Metrics {
+  const char CONTENT_TYPE[] = "text/plain; version=0.0.4";
+  
+  std::atomic<const Metric*> Metric::_first(nullptr);
+  
+  Metric::Metric(const char* name, const char* help, const char* type) :
+    _name(name),
+    _help(help),
+    _type(type),
+    _next(nullptr)
+  {
+    _next = _first.load(std::memory_order_relaxed);
+    while (!_first.compare_exchange_weak(_next, this, std::memory_order_release)) {
+    }
+  }
+  
+  const Metric* Metric::GetFirst() {
+    return _first.load(std::memory_order_acquire);
+  }
+  
+  const Metric* Metric::GetNext() const {
+    return _next;
+  }
+  
+  void Metric::Write(std::string& output) const {
+    output.append("# HELP ").append(_name).append(" ").append(_help).append("\n");
+    output.append("# TYPE ").append(_name).append(" ").append(_type).append("\n");
+    WriteSamples(output);
+  }
+  
+  void Metric::WriteSample(std::string& output, const char* suffix, const char* labels, unsigned long value) const {
+    char text[32];
+    snprintf(text, sizeof(text), "%lu", value);
+    WriteSample(output, suffix, labels, text);
+  }
+  
+  void Metric::WriteSample(std::string& output, const char* suffix, const char* labels, long value) const {
+    char text[32];
+    snprintf(text, sizeof(text), "%ld", value);
+    WriteSample(output, suffix, labels, text);
+  }
+  
+  void Metric::WriteSample(std::string& output, const char* suffix, const char* labels, double value) const {
+    char text[32];
+    snprintf(text, sizeof(text), "%.9g", value);
+    WriteSample(output, suffix, labels, text);
+  }
+  
+  void Metric::WriteSample(std::string& output, const char* suffix, const char* labels, const char* value) const {
+    output.append(_name).append(suffix).append(labels).append(" ").append(value).append("\n");
+  }
+  
+  Counter::Counter(const char* name, const char* help) :
+    Metric(name, help, "counter"),
+    _value(0)
+  {
+  }
+  
+  void Counter::WriteSamples(std::string& output) const {
+    WriteSample(output, "", "", Get());
+  }
+  
+  Gauge::Gauge(const char* name, const char* help) :
+    Metric(name, help, "gauge"),
+    _value(0)
+  {
+  }
+  
+  void Gauge::WriteSamples(std::string& output) const {
+    WriteSample(output, "", "", Get());
+  }
+  
+  Histogram::Histogram(const char* name, const char* help, const unsigned long* bounds, size_t boundsCount, double scale) :
+    Metric(name, help, "histogram"),
+    _bounds(bounds),
+    _boundsCount((boundsCount < BOUNDS_MAX) ? boundsCount : BOUNDS_MAX),
+    _scale(scale),
+    _sum(0)
+  {
+    for (auto& bucketCount : _bucketCounts) {
+      bucketCount.store(0, std::memory_order_relaxed);
+    }
+  }
+  
+  void Histogram::Observe(unsigned long value) {
+    size_t bucketIdx = 0;
+    while (bucketIdx < _boundsCount && value > _bounds[bucketIdx]) {
+      ++bucketIdx;
+    }
+    
+    _bucketCounts[bucketIdx].fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+  }
+  
+  void Histogram::WriteSamples(std::string& output) const {
+    // Buckets are exported cumulative, a scrape during Observe() may be off by one.
+    unsigned long count = 0;
+    char labels[48];
+    
+    for (size_t bucketIdx = 0; bucketIdx < _boundsCount; ++bucketIdx) {
+      count += _bucketCounts[bucketIdx].load(std::memory_order_relaxed);
+      snprintf(labels, sizeof(labels), "{le=\"%g\"}", _bounds[bucketIdx] * _scale);
+      WriteSample(output, "_bucket", labels, count);
+    }
+    
+    count += _bucketCounts[_boundsCount].load(std::memory_order_relaxed);
+    WriteSample(output, "_bucket", "{le=\"+Inf\"}", count);
+    WriteSample(output, "_sum", "", _sum.load(std::memory_order_relaxed) * _scale);
+    WriteSample(output, "_count", "", count);
+  }
+  
+  void WriteAll(std::string& output) {
+    for (const Metric* metric = Metric::GetFirst(); metric != nullptr; metric = metric->GetNext()) {
+      metric->Write(output);
+    }
+  }
+}
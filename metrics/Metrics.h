@@ -0,0 +1,140 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Lock-free counters, gauges and histograms exported in the Prometheus text
+// format. Metrics are objects with static storage duration: they register
+// themselves on construction and are never removed. Values are unsigned
+// long, so that updates stay lock-free on 32-bit targets too; counters wrap
+// there, which Prometheus handles as a reset. Only histogram sums are 64-bit.
+namespace Metrics {
+  class Metric {
+  public:
+    static const Metric* GetFirst();
+    const Metric* GetNext() const;
+    
+    // Appends HELP, TYPE and the samples of the metric.
+    void Write(std::string& output) const;
+    
+  protected:
+    Metric(const char* name, const char* help, const char* type);
+    
+    virtual void WriteSamples(std::string& output) const = 0;
+    
+    void WriteSample(std::string& output, const char* suffix, const char* labels, unsigned long value) const;
+    void WriteSample(std::string& output, const char* suffix, const char* labels, long value) const;
+    void WriteSample(std::string& output, const char* suffix, const char* labels, double value) const;
+    void WriteSample(std::string& output, const char* suffix, const char* labels, const char* value) const;
+    
+  private:
+    Metric(const Metric&) = delete;
+    Metric& operator=(const Metric&) = delete;
+    
+    const char* _name;
+    const char* _help;
+    const char* _type;
+    const Metric* _next;
+    
+    static std::atomic<const Metric*> _first;
+  };
+  
+  class Counter : public Metric {
+  public:
+    Counter(const char* name, const char* help);
+    
+    void Increment(unsigned long value = 1) {
+      _value.fetch_add(value, std::memory_order_relaxed);
+    }
+    
+    unsigned long Get() const {
+      return _value.load(std::memory_order_relaxed);
+    }
+    
+  protected:
+    void WriteSamples(std::string& output) const override;
+    
+  private:
+    std::atomic<unsigned long> _value;
+  };
+  
+  class Gauge : public Metric {
+  public:
+    Gauge(const char* name, const char* help);
+    
+    void Set(long value) {
+      _value.store(value, std::memory_order_relaxed);
+    }
+    
+    void Add(long value) {
+      _value.fetch_add(value, std::memory_order_relaxed);
+    }
+    
+    long Get() const {
+      return _value.load(std::memory_order_relaxed);
+    }
+    
+  protected:
+    void WriteSamples(std::string& output) const override;
+    
+  private:
+    std::atomic<long> _value;
+  };
+  
+  // Observations are integers (e.g. microseconds), scale converts them and
+  // the bucket bounds to the exported unit (e.g. 1e-6 for seconds).
+  class Histogram : public Metric {
+  public:
+    static const size_t BOUNDS_MAX = 16;
+    
+    // bounds are ascending and have to outlive the histogram.
+    Histogram(const char* name, const char* help, const unsigned long* bounds, size_t boundsCount, double scale = 1.0);
+    
+    void Observe(unsigned long value);
+    
+  protected:
+    void WriteSamples(std::string& output) const override;
+    
+  private:
+    const unsigned long* _bounds;
+    size_t _boundsCount;
+    double _scale;
+    // The last bucket counts values above all bounds.
+    std::array<std::atomic<unsigned long>, BOUNDS_MAX + 1> _bucketCounts;
+    // 64-bit, since a 32-bit sum of microseconds wraps after about 71 minutes
+    // and would no longer match the count.
+    std::atomic<uint64_t> _sum;
+  };
+  
+  // Prometheus text exposition format, version 0.0.4.
+  extern const char CONTENT_TYPE[];
+  
+  void WriteAll(std::string& output);
+}
+
+#endif // METRICS_H
@@ -0,0 +1,64 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef CONTROLMESSAGE_H
+#define CONTROLMESSAGE_H
+
+#include <cstddef>
+
+// 8-byte HID report which sets brightness of one MP710 channel.
+class ControlMessage 
+{
+public:
+  static const size_t SIZE = 8;
+  
+  ControlMessage(unsigned char channelIdx, unsigned char brightness)
+    : _commandData {0x63,channelIdx,brightness,0x00,0x08,0xff,0x08,0xff}
+  {
+  }
+  
+  unsigned char* GetData()
+  {
+    return &_commandData[0];
+  }
+  
+  // Extracts channel and brightness from a report. Returns false if it is not a brightness report.
+  static bool Decode(const unsigned char* data, size_t size, unsigned& channelIdx, unsigned& brightness)
+  {
+    if (size != SIZE || data[0] != 0x63) {
+      return false;
+    }
+    
+    channelIdx = data[1];
+    brightness = data[2];
+    
+    return true;
+  }
+  
+  ControlMessage() = delete;
+  ControlMessage(const ControlMessage&) = delete;
+  ControlMessage& operator=(const ControlMessage&) = delete;
+  
+private:
+  unsigned char _commandData[SIZE];
+};
+
+#endif // CONTROLMESSAGE_H
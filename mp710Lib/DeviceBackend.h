@@ -0,0 +1,54 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef DEVICEBACKEND_H
+#define DEVICEBACKEND_H
+
+#include <cstddef>
+#include <functional>
+
+#include "DeviceController.h"
+
+// Transport used by DeviceController to talk to the device. All methods are
+// called on the worker thread only, between Start() and Stop().
+class DeviceBackend {
+public:
+    
+    typedef std::function<void(bool result, const DeviceController::Command& command)> CompletionHandler;
+    
+    virtual ~DeviceBackend() {}
+    
+    virtual void Start(CompletionHandler completionHandler) = 0;
+    virtual void Stop() = 0;
+    
+    virtual bool IsOpen() const = 0;
+    virtual bool CanSubmit() const = 0;
+    virtual size_t GetInFlight() const = 0;
+    
+    // Starts sending of the command. The completion handler is called from WaitForEvents().
+    virtual bool Submit(const DeviceController::Command& command) = 0;
+    
+    // Blocks until a submitted command is finished, wakeupFd becomes readable or
+    // timeoutMs expires (-1 waits infinitely) and completes finished commands.
+    virtual void WaitForEvents(int wakeupFd, int timeoutMs) = 0;
+};
+
+#endif // DEVICEBACKEND_H
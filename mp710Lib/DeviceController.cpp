@@ -22,148 +22,116 @@
 #include "DeviceController.h"
 
 #include <algorithm>
-#include <libusb-1.0/libusb.h>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
+#include "DeviceBackend.h"
+#include "DeviceMetrics.h"
+#include "UsbBackend.h"
 #include "../tracer/Tracer.h"
 
 namespace {
-  const uint16_t DEV_VID = 0x16c0;
-  const uint16_t DEV_PID = 0x05df;
-  const int DEV_CONFIG = 1;
-  const int DEV_INTF = 0;
-  unsigned char EP_IN = 0x81;
-}
-
-class ControlMessage 
-{
-public:
-  ControlMessage(unsigned char channelIdx, unsigned char brightness)
-    : _commandData {0x63,channelIdx,brightness,0x00,0x08,0xff,0x08,0xff}
-  {
-  }
+  // Commands are packed into one word so that they can be stored atomically:
+  // bits 0-7 param, bits 8-9 easing, bits 10-11 type, bits 12-31 fade duration
+  // in FADE_DURATION_UNIT_MS units. Channel index is the index of the word.
+  const unsigned FADE_DURATION_UNIT_MS = 10;
+  const uint32_t PACKED_NOT_SET = 3;
+  const int VALUE_UNKNOWN = -1;
+  // Under back to back batches a clean snapshot may never come, so after this
+  // many attempts the worker takes what is pending. A torn batch then shows
+  // for one round only, as its channels are pending again.
+  const unsigned SNAPSHOT_ATTEMPTS_MAX = 64;
   
-  unsigned char* GetData()
-  {
-    return &_commandData[0];
+  uint32_t PackCommand(const DeviceController::Command& command) {
+    uint32_t type = (command.Type == DeviceController::NOT_SET) ? PACKED_NOT_SET : static_cast<uint32_t>(command.Type);
+    uint32_t duration = (command.Duration + FADE_DURATION_UNIT_MS - 1) / FADE_DURATION_UNIT_MS;
+    
+    return (duration << 12) | ((type & 0x3) << 10) | ((static_cast<uint32_t>(command.Easing) & 0x3) << 8) | (command.Param & 0xFF);
   }
   
-  ControlMessage() = delete;
-  ControlMessage(const ControlMessage&) = delete;
-  ControlMessage& operator=(const ControlMessage&) = delete;
+  DeviceController::Command UnpackCommand(unsigned channelIdx, uint32_t packedCommand) {
+    uint32_t type = (packedCommand >> 10) & 0x3;
+    
+    return DeviceController::Command(
+      (type == PACKED_NOT_SET) ? DeviceController::NOT_SET : static_cast<DeviceController::CommandTypesEnum>(type),
+      channelIdx,
+      packedCommand & 0xFF,
+      (packedCommand >> 12) * FADE_DURATION_UNIT_MS,
+      static_cast<DeviceController::EasingEnum>((packedCommand >> 8) & 0x3));
+  }
   
-private:
-  unsigned char _commandData[8];
-};
-
-// int main1(int argc, char **argv) {
-// 
-//   // Register handler for CTRL+C
-//   if (signal(SIGINT, sigIntHandler) == SIG_ERR) {
-//     Tracer::Log("Failed to setup SIGINT handler.\n");
-//   }
-//     
-//   // Register handler for termination
-//   if (signal(SIGTERM, sigIntHandler) == SIG_ERR) {
-//     Tracer::Log("Failed to setup SIGTERM handler.\n");
-//   }
-//   
-//   libusb_init(nullptr);
-//   libusb_set_debug(nullptr, 3);
-//   libusb_device_handle* handle = libusb_open_device_with_vid_pid(nullptr, DEV_VID, DEV_PID);
-//   if (handle == nullptr) {
-//       Tracer::Log("Failed to open device\n");
-//       libusb_exit(nullptr);
-//       return EXIT_FAILURE;
-//   }
-//   
-//   if (libusb_kernel_driver_active(handle, DEV_INTF))
-//   {
-//     libusb_detach_kernel_driver(handle, DEV_INTF);
-//   }
-//   
-//   int ret;
-//   if ((ret = libusb_set_configuration(handle, DEV_CONFIG)) < 0)
-//   {
-//     Tracer::Log("Failed to configure device, error: %i.\n", ret);
-//     libusb_close(handle);
-//     libusb_exit(nullptr);
-//     if (ret == LIBUSB_ERROR_BUSY)
-//     {
-//         Tracer::Log("Device is busy\n");
-//     }
-//     
-//     return EXIT_FAILURE;
-//   }
-//   
-//   if (libusb_claim_interface(handle,  DEV_INTF) < 0)
-//   {
-//     Tracer::Log("Failed to claim interface.\n");
-//     libusb_close(handle);
-//     libusb_exit(nullptr);
-//     return EXIT_FAILURE;
-//   }
-//   
-//   unsigned char buf[65];
-//         
-//   if (argc > 1)
-//   {
-//     const unsigned char OFF_BRIGHTNESS = 0x0;
-//     
-//     for (unsigned portIdx = 0; portIdx < 16; ++portIdx)
-//     {
-//       ControlMessage msg(portIdx, 0);
-//       ret = libusb_control_transfer(handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT,
-//                                     0x9, 0x300, 0, msg.GetData(), 8, 100);
-//       libusb_interrupt_transfer(handle, EP_IN, buf, 8, &ret, 100);
-//     }
-// 
-//     Tracer::Log("Set brightness to %d.\n", OFF_BRIGHTNESS);
-//   }
-//   else 
-//   {
-//     for (unsigned brightness = 0; brightness <= 128; ++brightness)
-//     {
-//       for (unsigned portIdx = 0; portIdx < 16; ++portIdx)
-//       {
-//         ControlMessage msg(portIdx, brightness);
-//         ret = libusb_control_transfer(handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT,
-//                                       0x9, 0x300, 0, msg.GetData(), 8, 100);
-//         libusb_interrupt_transfer(handle, EP_IN, buf, 8, &ret, 100);
-//       }
-// 
-//       Tracer::Log("Set brightness to %d.\n", brightness);
-//       
-//       std::this_thread::sleep_for(std::chrono::seconds(15));
-//     }
-//   }
-//   
-//   libusb_attach_kernel_driver(handle, DEV_INTF);
-//   libusb_close(handle);
-//   libusb_exit(nullptr);  
-//   
-//   return EXIT_SUCCESS;
-// }
-
-const unsigned DeviceController::CHANNELS_NUMBER = 16;
-const unsigned DeviceController::BRIGHTNESS_MAX = 128;
-
-DeviceController::DeviceController(size_t maxCommandQueueSize, DoneCallback doneCallback)
-    : _maxQueueSize(maxCommandQueueSize),
+  double ApplyEasing(DeviceController::EasingEnum easing, double progress) {
+    switch (easing) {
+      case DeviceController::EASE_IN:
+        return progress * progress;
+      case DeviceController::EASE_OUT:
+        return 1.0 - (1.0 - progress) * (1.0 - progress);
+      case DeviceController::EASE_IN_OUT:
+        return progress * progress * (3.0 - 2.0 * progress);
+      case DeviceController::EASE_LINEAR:
+      default:
+        return progress;
+    }
+  }
+}
+
+constexpr unsigned DeviceController::CHANNELS_NUMBER;
+constexpr unsigned DeviceController::BRIGHTNESS_MAX;
+const size_t DeviceController::DEFAULT_TRANSFERS_IN_FLIGHT = 16;
+const unsigned DeviceController::DEFAULT_FADE_TICK_MS = 20;
+const unsigned DeviceController::FADE_DURATION_MAX_MS = 0xFFFFF * FADE_DURATION_UNIT_MS;
+
+static_assert(DeviceController::CHANNELS_NUMBER <= 32, "Pending channels must fit into 32-bit mask");
+
+DeviceController::DeviceController(DoneCallback doneCallback)
+    : DeviceController(doneCallback, std::unique_ptr<DeviceBackend>(new UsbBackend()))
+{
+}
+
+DeviceController::DeviceController(DoneCallback doneCallback, std::unique_ptr<DeviceBackend> backend)
+    : _backend(std::move(backend)),
     _shouldStop(false),
-    _lastCommands(CHANNELS_NUMBER),
+    _pendingChannelsMask(0),
+    _batchesStarted(0),
+    _batchesFinished(0),
+    _takenChannelsMask(0),
+    _commandsInProgress(0),
+    _activeFadesMask(0),
+    _fadeTickMs(DEFAULT_FADE_TICK_MS),
+    _refreshPeriodMs(0),
+    _suppressedWritesCount(0),
+    _lastCommandsSequence(0),
+    _wakeupFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
     _doneCallback(doneCallback)
 {
-    for (size_t i = 0; i < _lastCommands.size(); ++i) {
-        _lastCommands[i].ChannelIdx = i;
+    if (_wakeupFd < 0) {
+        TRACER_ERRNO(Tracer::CATEGORY_DEVICE, "Failed to create wakeup event.\n");
     }
     
+    for (auto& lastCommand : _lastCommands) {
+        lastCommand = PackCommand(Command());
+    }
+    
+    for (auto& pendingCommand : _pendingCommands) {
+        pendingCommand = PackCommand(Command());
+    }
+    
+    _submittedValues.fill(VALUE_UNKNOWN);
+    
     std::thread workerThread(&DeviceController::WorkerThreadFunc, this);    
     _workerThread.swap(workerThread); 
 }
 
 DeviceController::~DeviceController() {
     _shouldStop = true;
+    Wakeup();
     _workerThread.join();
+    
+    if (_wakeupFd >= 0) {
+        close(_wakeupFd);
+    }
 }
 
 void DeviceController::AddCommand(CommandTypesEnum type, unsigned channelIdx, unsigned param) {
@@ -171,158 +139,362 @@ void DeviceController::AddCommand(CommandTypesEnum type, unsigned channelIdx, un
 }
 
 void DeviceController::AddCommand(const Command& command) {
-    {
-      std::unique_lock<std::mutex> queueLock(_queueMutex);
-      
-      if (_maxQueueSize < _commandsQueue.size()) {
-          Tracer::Log("Dropped command because the command queue is full.\n");
-          return;
-      }
-
-      _commandsQueue.push_back(command);
-  }
+    AddCommands(&command, 1);
 }
 
-bool DeviceController::WaitForCommands(std::chrono::milliseconds timeout) {
-
-  while (true)
-  {
-    {
-      std::unique_lock<std::mutex> queueLock(_queueMutex);
-      if (_commandsQueue.empty())
-      {
-          return true;
-      }
+void DeviceController::AddCommands(const Command* commands, size_t count) {
+    uint32_t channelsMask = 0;
+    unsigned validCount = 0;
+    
+    // The worker discards a snapshot that overlaps a batch still being stored.
+    _batchesStarted.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    
+    for (size_t i = 0; i < count; ++i) {
+        const Command& command = commands[i];
+        
+        if ((command.Type != SET_BRIGHTNESS && command.Type != FADE) ||
+            command.ChannelIdx >= CHANNELS_NUMBER ||
+            command.Param > BRIGHTNESS_MAX ||
+            command.Duration > FADE_DURATION_MAX_MS) {
+            TRACER_WARN(Tracer::CATEGORY_DEVICE, "Dropped invalid command %u at channel %u with param %u.\n",
+                        static_cast<unsigned>(command.Type),
+                        static_cast<unsigned>(command.ChannelIdx),
+                        static_cast<unsigned>(command.Param));
+            DeviceMetrics::CommandsInvalid.Increment();
+            continue;
+        }
+        
+        _pendingCommands[command.ChannelIdx].store(PackCommand(command), std::memory_order_relaxed);
+        channelsMask |= 1U << command.ChannelIdx;
+        ++validCount;
     }
-      
-    {
-      std::unique_lock<std::mutex> lock(_isQueueEmptyMutex);
-      if (_isQueueEmptyCondition.wait_for(lock, timeout) == std::cv_status::timeout)
-      {
-          return false;
-      }
+    
+    if (0 == channelsMask) {
+        _batchesFinished.fetch_add(1, std::memory_order_release);
+        return;
     }
-      
-    {
-      std::unique_lock<std::mutex> queueLock(_queueMutex);
-      if (_commandsQueue.empty())
-      {
-          return true;
-      }
+    
+    // All channels of the batch become visible to the worker at once.
+    uint32_t previousMask = _pendingChannelsMask.fetch_or(channelsMask, std::memory_order_release);
+    _batchesFinished.fetch_add(1, std::memory_order_release);
+    
+    DeviceMetrics::CommandsAdded.Increment(validCount);
+    DeviceMetrics::CommandsCoalesced.Increment(validCount - __builtin_popcount(channelsMask & ~previousMask));
+    
+    // The worker is already signalled if other channels were pending.
+    if (0 == previousMask) {
+        Wakeup();
     }
+}
 
-    // It is a spurious wakeup
-  }
+bool DeviceController::WaitForCommands(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(_isQueueEmptyMutex);
+  
+  return _isQueueEmptyCondition.wait_for(lock, timeout, [this]() { return IsIdle(); });
+}
+
+void DeviceController::SetFadeTick(std::chrono::milliseconds tick) {
+    _fadeTickMs = std::max<unsigned>(tick.count(), 1);
+}
+
+void DeviceController::SetWriteVerification(std::chrono::milliseconds refreshPeriod) {
+    _refreshPeriodMs = refreshPeriod.count();
+}
+
+uint32_t DeviceController::GetSuppressedWritesCount() const {
+    return _suppressedWritesCount;
 }
 
 void DeviceController::Reset() {
 }
 
 std::tuple<DeviceController::CommandTypesEnum, unsigned> DeviceController::GetLastCommand(unsigned int channelIdx) const {
-   return std::tuple<DeviceController::CommandTypesEnum, unsigned>(DeviceController::NOT_SET, 0); 
+   if (channelIdx >= CHANNELS_NUMBER) {
+       return std::tuple<DeviceController::CommandTypesEnum, unsigned>(DeviceController::NOT_SET, 0); 
+   }
+   
+   // A single channel is one atomic word, so it needs no sequence check.
+   Command command = UnpackCommand(channelIdx, _lastCommands[channelIdx].load(std::memory_order_acquire));
+   
+   return std::tuple<DeviceController::CommandTypesEnum, unsigned>(command.Type, command.Param); 
 }
 
-std::vector<DeviceController::Command> DeviceController::GetLastCommands() const {
-    return _lastCommands;
+void DeviceController::GetSnapshot(Snapshot& snapshot) const {
+    uint32_t sequence;
+    
+    do {
+        sequence = _lastCommandsSequence.load(std::memory_order_acquire);
+        
+        for (unsigned channelIdx = 0; channelIdx < CHANNELS_NUMBER; ++channelIdx) {
+            snapshot.Commands[channelIdx] = UnpackCommand(channelIdx, _lastCommands[channelIdx].load(std::memory_order_relaxed));
+        }
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    while ((sequence & 1) != 0 || sequence != _lastCommandsSequence.load(std::memory_order_relaxed));
+    
+    snapshot.Version = sequence / 2;
 }
 
-bool DeviceController::ExecCommand(const Command& command) {
+void DeviceController::StoreLastCommand(const Command& command) {
+    uint32_t sequence = _lastCommandsSequence.load(std::memory_order_relaxed);
+    
+    _lastCommandsSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    
+    _lastCommands[command.ChannelIdx].store(PackCommand(command), std::memory_order_relaxed);
+    
+    _lastCommandsSequence.store(sequence + 2, std::memory_order_release);
+}
 
-  libusb_device_handle* handle = libusb_open_device_with_vid_pid(nullptr, DEV_VID, DEV_PID);
-  if (nullptr == handle) {
-      Tracer::Log("Failed to open device\n");
-      return false;
-  }
-  
-  if (libusb_kernel_driver_active(handle, DEV_INTF))
-  {
-    libusb_detach_kernel_driver(handle, DEV_INTF);
-  }
-  
-  int ret;
-  if ((ret = libusb_set_configuration(handle, DEV_CONFIG)) < 0)
-  {
-    Tracer::Log("Failed to configure device, error: %i.\n", ret);
-    if (ret == LIBUSB_ERROR_BUSY)
-    {
-        Tracer::Log("Device is busy\n");
+void DeviceController::Wakeup() {
+    if (_wakeupFd < 0) {
+        return;
     }
     
-    libusb_close(handle);
-    return false;
-  }
-  
-  if (libusb_claim_interface(handle,  DEV_INTF) < 0)
-  {
-    Tracer::Log("Failed to claim interface.\n");
-    
-    libusb_close(handle);
-    return false;
-  }
-  
-  ControlMessage msg(command.ChannelIdx, command.Param);
-  ret = libusb_control_transfer(handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT,
-                                0x9, 0x300, 0, msg.GetData(), 8, 100);
-  
-  unsigned char buf[65];
-  libusb_interrupt_transfer(handle, EP_IN, buf, 8, &ret, 100);
+    const uint64_t increment = 1;
+    if (write(_wakeupFd, &increment, sizeof(increment)) < 0 && errno != EAGAIN) {
+        TRACER_ERRNO(Tracer::CATEGORY_DEVICE, "Failed to wake up worker.\n");
+    }
+}
 
-  Tracer::Log("Set brightness to %d.\n", command.Param);
-  
-  libusb_attach_kernel_driver(handle, DEV_INTF);
+void DeviceController::WaitForWakeup(int timeoutMs) {
+    if (_wakeupFd < 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs < 0 ? 15 : timeoutMs));
+        return;
+    }
+    
+    pollfd wakeupPollFd = {_wakeupFd, POLLIN, 0};
+    if (poll(&wakeupPollFd, 1, timeoutMs) < 0 && errno != EINTR) {
+        TRACER_ERRNO(Tracer::CATEGORY_DEVICE, "Failed to wait for commands.\n");
+    }
+}
 
-  libusb_close(handle);
-  
-  _lastCommands[command.ChannelIdx] = command;
-  
-  return true;  
+void DeviceController::ClearWakeup() {
+    if (_wakeupFd < 0) {
+        return;
+    }
+    
+    uint64_t counter = 0;
+    if (read(_wakeupFd, &counter, sizeof(counter)) < 0 && errno != EAGAIN) {
+        TRACER_ERRNO(Tracer::CATEGORY_DEVICE, "Failed to reset wakeup event.\n");
+    }
 }
 
-void DeviceController::WorkerThreadFunc() {
-  
-  libusb_init(nullptr);
-  libusb_set_debug(nullptr, 3);
+bool DeviceController::IsIdle() const {
+    // The worker marks a command as in progress before it clears the pending bit.
+    return 0 == _pendingChannelsMask.load() && 0 == _commandsInProgress.load();
+}
 
-  while (!_shouldStop) {
-        
-        Command cmd;
-        
-        {
-            std::unique_lock<std::mutex> queueLock(_queueMutex);
+bool DeviceController::PopCommand(Command& cmd) {
+    if (0 == _takenChannelsMask) {
+        // Take all pending channels at once, so a batch is never split.
+        ++_commandsInProgress;
+        for (unsigned attempt = 1; ; ++attempt) {
+            const bool isLastAttempt = attempt >= SNAPSHOT_ATTEMPTS_MAX;
             
-            if (_commandsQueue.size() != 0) {
-                cmd = _commandsQueue.front();
-                _commandsQueue.pop_front();
-
-                auto isSameChannelIdx = [&cmd](const Command& item) {
-                  return item.ChannelIdx == cmd.ChannelIdx;
-                };
-
-                // Find tha last command with same channelIdx
-                auto rIt = std::find_if(_commandsQueue.rbegin(), _commandsQueue.rend(), isSameChannelIdx);
-                if (rIt != _commandsQueue.rend()) {
-                  cmd = *rIt;
-                  
-                  _commandsQueue.remove_if(isSameChannelIdx);
-                }
+            // Wait until no batch is half stored, then take a snapshot and
+            // keep it only if no new batch started while it was being read.
+            uint32_t finished = _batchesFinished.load(std::memory_order_acquire);
+            uint32_t started = _batchesStarted.load(std::memory_order_relaxed);
+            if (started != finished && !isLastAttempt) {
+                std::this_thread::yield();
+                continue;
             }
-            else {
-              _isQueueEmptyCondition.notify_one();
+            
+            _takenChannelsMask = _pendingChannelsMask.exchange(0, std::memory_order_acq_rel);
+            
+            for (uint32_t mask = _takenChannelsMask; mask != 0; mask &= mask - 1) {
+                unsigned channelIdx = __builtin_ctz(mask);
+                _takenCommands[channelIdx] = UnpackCommand(channelIdx, _pendingCommands[channelIdx].load(std::memory_order_relaxed));
             }
+            
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_batchesStarted.load(std::memory_order_relaxed) == started || isLastAttempt) {
+                break;
+            }
+            
+            // The slots still hold the newest commands, so give the channels back and retry.
+            _pendingChannelsMask.fetch_or(_takenChannelsMask, std::memory_order_relaxed);
+            _takenChannelsMask = 0;
         }
+        _commandsInProgress += __builtin_popcount(_takenChannelsMask);
+        --_commandsInProgress;
+    }
+    
+    if (0 == _takenChannelsMask) {
+        return false;
+    }
+    
+    unsigned channelIdx = __builtin_ctz(_takenChannelsMask);
+    _takenChannelsMask &= _takenChannelsMask - 1;
+    
+    cmd = _takenCommands[channelIdx];
+    
+    return true;
+}
+
+void DeviceController::SubmitCommand(const Command& command) {
+    const unsigned channelIdx = command.ChannelIdx;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    
+    // The device state is unknown until it is written after (re)opening.
+    if (!_backend->IsOpen()) {
+        _submittedValues.fill(VALUE_UNKNOWN);
+    }
+    
+    if (_submittedValues[channelIdx] == static_cast<int>(command.Param)) {
+        const unsigned refreshPeriodMs = _refreshPeriodMs;
+        const bool isRefreshDue = refreshPeriodMs != 0 &&
+                                  now - _submittedTimes[channelIdx] >= std::chrono::milliseconds(refreshPeriodMs);
         
-        if (cmd.Type != NOT_SET) {
-            ExecCommand(cmd);
-            
-            if (_doneCallback != nullptr) {
-                _doneCallback(true, cmd.Type, cmd.ChannelIdx, cmd.Param);
+        if (!isRefreshDue) {
+            ++_suppressedWritesCount;
+            DeviceMetrics::WritesSuppressed.Increment();
+            --_commandsInProgress;
+            return;
+        }
+    }
+    
+    if (_backend->Submit(command)) {
+        _submittedValues[channelIdx] = command.Param;
+        _submittedTimes[channelIdx] = now;
+    }
+    else {
+        OnCommandDone(false, command);
+    }
+}
+
+void DeviceController::StartCommand(const Command& command) {
+    const unsigned channelIdx = command.ChannelIdx;
+    const uint32_t channelBit = 1U << channelIdx;
+    
+    // A new command for the channel supersedes its running fade.
+    if ((_activeFadesMask & channelBit) != 0) {
+        _activeFadesMask &= ~channelBit;
+        --_commandsInProgress;
+    }
+    
+    if (command.Type == FADE && command.Duration != 0) {
+        FadeState& fade = _fades[channelIdx];
+        fade.From = (_submittedValues[channelIdx] == VALUE_UNKNOWN) ? 0 : _submittedValues[channelIdx];
+        fade.To = command.Param;
+        fade.Start = std::chrono::steady_clock::now();
+        fade.Duration = std::chrono::milliseconds(command.Duration);
+        fade.Easing = command.Easing;
+        
+        // The fade stays in progress until its last value is submitted.
+        _activeFadesMask |= channelBit;
+        return;
+    }
+    
+    SubmitCommand(Command(SET_BRIGHTNESS, channelIdx, command.Param));
+}
+
+void DeviceController::UpdateFades() {
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    
+    for (uint32_t mask = _activeFadesMask; mask != 0; mask &= mask - 1) {
+        const unsigned channelIdx = __builtin_ctz(mask);
+        const FadeState& fade = _fades[channelIdx];
+        
+        const std::chrono::steady_clock::duration elapsed = now - fade.Start;
+        const bool isFinished = elapsed >= fade.Duration;
+        
+        unsigned value = fade.To;
+        if (!isFinished) {
+            double progress = std::chrono::duration<double>(elapsed) / std::chrono::duration<double>(fade.Duration);
+            double eased = ApplyEasing(fade.Easing, progress);
+            value = static_cast<unsigned>(fade.From + (static_cast<double>(fade.To) - fade.From) * eased + 0.5);
+        }
+        
+        // Only quantized changes are sent to the device.
+        if (static_cast<int>(value) != _submittedValues[channelIdx]) {
+            if (!_backend->CanSubmit()) {
+                continue;
             }
+            
+            ++_commandsInProgress;
+            SubmitCommand(Command(SET_BRIGHTNESS, channelIdx, value));
         }
-        else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(15));
+        
+        if (isFinished) {
+            _activeFadesMask &= ~(1U << channelIdx);
+            --_commandsInProgress;
         }
+    }
+}
+
+void DeviceController::OnCommandDone(bool result, const Command& command) {
+  
+  if (result) {
+    TRACER_DEBUG(Tracer::CATEGORY_DEVICE, "Set brightness to %d.\n", command.Param);
+    
+    StoreLastCommand(command);
+    DeviceMetrics::CommandsExecuted.Increment();
+  }
+  else {
+    // The device may or may not have the value, so the next write of it must not be suppressed.
+    if (command.ChannelIdx < CHANNELS_NUMBER) {
+      _submittedValues[command.ChannelIdx] = VALUE_UNKNOWN;
+    }
+    
+    DeviceMetrics::CommandsFailed.Increment();
+  }
+  
+  if (_doneCallback != nullptr) {
+      _doneCallback(result, command.Type, command.ChannelIdx, command.Param);
+  }
+  
+  --_commandsInProgress;
+}
+
+void DeviceController::WorkerThreadFunc() {
+  
+  _backend->Start(std::bind(&DeviceController::OnCommandDone, this, std::placeholders::_1, std::placeholders::_2));
+
+  std::chrono::steady_clock::time_point nextFadeTick = std::chrono::steady_clock::now();
+
+  while (!_shouldStop) {
+    
+    // Keep the pipeline full so that queued channels are sent back-to-back.
+    Command cmd;
+    while (_backend->CanSubmit() && PopCommand(cmd)) {
+      StartCommand(cmd);
+    }
+    
+    DeviceMetrics::PendingChannels.Set(__builtin_popcount(_pendingChannelsMask.load(std::memory_order_relaxed) | _takenChannelsMask));
+    DeviceMetrics::CommandsInProgress.Set(_commandsInProgress.load(std::memory_order_relaxed));
+    
+    int timeoutMs = -1;
+    if (_activeFadesMask != 0) {
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now >= nextFadeTick) {
+        UpdateFades();
+        nextFadeTick = now + std::chrono::milliseconds(_fadeTickMs);
+      }
+      
+      timeoutMs = std::chrono::duration_cast<std::chrono::milliseconds>(nextFadeTick - now).count();
+      timeoutMs = std::max(timeoutMs, 0);
+    }
+    
+    // Sleep until a transfer is finished, a new command is added or next fade tick.
+    if (_backend->GetInFlight() != 0) {
+      _backend->WaitForEvents(_wakeupFd, timeoutMs);
+    }
+    else {
+      if (_activeFadesMask == 0) {
+        std::unique_lock<std::mutex> lock(_isQueueEmptyMutex);
+        _isQueueEmptyCondition.notify_all();
+      }
+      
+      WaitForWakeup(timeoutMs);
+    }
+    
+    ClearWakeup();
   }
     
-  libusb_exit(nullptr);  
+  _backend->Stop();
     
-}
\ No newline at end of file
+}
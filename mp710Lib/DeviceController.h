@@ -22,64 +22,139 @@
 #ifndef DEVICECONTROLLER_H
 #define DEVICECONTROLLER_H
 
-#include <list>
-#include <vector>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <tuple>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <functional>
+#include <memory>
+
+class DeviceBackend;
 
 class DeviceController {
 public:
     
-    static const unsigned CHANNELS_NUMBER;
-    static const unsigned BRIGHTNESS_MAX;
+    static constexpr unsigned CHANNELS_NUMBER = 16;
+    static constexpr unsigned BRIGHTNESS_MAX = 128;
+    static const size_t DEFAULT_TRANSFERS_IN_FLIGHT;
+    static const unsigned DEFAULT_FADE_TICK_MS;
+    static const unsigned FADE_DURATION_MAX_MS;
     
-    enum CommandTypesEnum {SET_BRIGHTNESS = 0, NOT_SET = 0xFFFF};
+    // FADE changes brightness from the current value to Param within Duration ms.
+    enum CommandTypesEnum {SET_BRIGHTNESS = 0, FADE = 1, NOT_SET = 0xFFFF};
+    enum EasingEnum {EASE_LINEAR = 0, EASE_IN = 1, EASE_OUT = 2, EASE_IN_OUT = 3};
     
     struct Command
     {
         CommandTypesEnum Type;
         unsigned ChannelIdx;
         unsigned Param;
+        unsigned Duration;
+        EasingEnum Easing;
         
         Command() 
-            : Type(NOT_SET), ChannelIdx(CHANNELS_NUMBER), Param(0)
+            : Type(NOT_SET), ChannelIdx(CHANNELS_NUMBER), Param(0), Duration(0), Easing(EASE_LINEAR)
         { }
 
         Command(CommandTypesEnum type, unsigned channelIdx, unsigned param) 
-            : Type(type), ChannelIdx(channelIdx), Param(param)
+            : Type(type), ChannelIdx(channelIdx), Param(param), Duration(0), Easing(EASE_LINEAR)
+        { }
+
+        Command(CommandTypesEnum type, unsigned channelIdx, unsigned param, unsigned duration, EasingEnum easing) 
+            : Type(type), ChannelIdx(channelIdx), Param(param), Duration(duration), Easing(easing)
         { }
     };    
     
+    // Consistent copy of all channel states. Version grows with every change.
+    struct Snapshot
+    {
+        uint32_t Version;
+        std::array<Command, CHANNELS_NUMBER> Commands;
+    };
+    
     typedef std::function<void(bool result, DeviceController::CommandTypesEnum command, unsigned channelIdx, unsigned param)> DoneCallback;
     
-    DeviceController(size_t maxCommandQueueSize, DoneCallback doneCallback);
+    // Uses the libusb backend if no backend is given.
+    explicit DeviceController(DoneCallback doneCallback);
+    DeviceController(DoneCallback doneCallback, std::unique_ptr<DeviceBackend> backend);
     ~DeviceController();
     
     void AddCommand(CommandTypesEnum type, unsigned channelIdx, unsigned param);
     void AddCommand(const Command& command);
+    void AddCommands(const Command* commands, size_t count);
     bool WaitForCommands(std::chrono::milliseconds timeout);
+    void SetFadeTick(std::chrono::milliseconds tick);
+    
+    // Writes of the value a channel already has are suppressed. A non-zero
+    // refresh period forces such writes once per period to resync the device.
+    void SetWriteVerification(std::chrono::milliseconds refreshPeriod);
+    uint32_t GetSuppressedWritesCount() const;
+    
     void Reset();
     std::tuple<CommandTypesEnum, unsigned> GetLastCommand(unsigned channelIdx) const;
-    std::vector<Command> GetLastCommands() const;
+    void GetSnapshot(Snapshot& snapshot) const;
     
     DeviceController(const DeviceController&) = delete;
     DeviceController& operator=(const DeviceController&) = delete;
 
 private:    
     
-    bool ExecCommand(const Command& command);
+    bool IsIdle() const;
+    void Wakeup();
+    void WaitForWakeup(int timeoutMs);
+    void ClearWakeup();
+    bool PopCommand(Command& cmd);
+    void SubmitCommand(const Command& command);
+    void StartCommand(const Command& command);
+    void UpdateFades();
+    void StoreLastCommand(const Command& command);
+    void OnCommandDone(bool result, const Command& command);
     void WorkerThreadFunc();
     
-    const size_t _maxQueueSize;
+    std::unique_ptr<DeviceBackend> _backend;
     volatile bool _shouldStop;
-    std::list<Command> _commandsQueue;
-    std::vector<Command> _lastCommands;
+    
+    // Commands are coalesced per channel: a newer command replaces a pending one.
+    // Producers only store a packed command and set its bit, so AddCommand never
+    // blocks; the worker is the only consumer.
+    std::array<std::atomic<uint32_t>, CHANNELS_NUMBER> _pendingCommands;
+    std::atomic<uint32_t> _pendingChannelsMask;
+    // Bracket every batch, so the worker never reads a batch half stored.
+    std::atomic<uint32_t> _batchesStarted;
+    std::atomic<uint32_t> _batchesFinished;
+    uint32_t _takenChannelsMask;
+    std::array<Command, CHANNELS_NUMBER> _takenCommands;
+    std::atomic<unsigned> _commandsInProgress;
+    
+    // Fades are interpolated by the worker every _fadeTickMs.
+    struct FadeState
+    {
+        unsigned From;
+        unsigned To;
+        std::chrono::steady_clock::time_point Start;
+        std::chrono::milliseconds Duration;
+        EasingEnum Easing;
+    };
+    
+    std::array<FadeState, CHANNELS_NUMBER> _fades;
+    uint32_t _activeFadesMask;
+    std::array<int, CHANNELS_NUMBER> _submittedValues;
+    std::array<std::chrono::steady_clock::time_point, CHANNELS_NUMBER> _submittedTimes;
+    std::atomic<unsigned> _fadeTickMs;
+    std::atomic<unsigned> _refreshPeriodMs;
+    std::atomic<uint32_t> _suppressedWritesCount;
+    
+    // Last executed commands guarded by a sequence lock: the worker is the only
+    // writer, readers retry while the sequence is odd or has changed.
+    std::array<std::atomic<uint32_t>, CHANNELS_NUMBER> _lastCommands;
+    std::atomic<uint32_t> _lastCommandsSequence;
+    int _wakeupFd;
 
     std::thread _workerThread;
-    mutable std::mutex _queueMutex;
     mutable std::mutex _isQueueEmptyMutex;
     mutable std::condition_variable _isQueueEmptyCondition;
     
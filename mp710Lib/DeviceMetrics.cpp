@@ -0,0 +1,49 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "DeviceMetrics.h"
+
+namespace DeviceMetrics {
+    
+    namespace {
+        const unsigned long TRANSFER_LATENCY_BOUNDS_US[] = {
+            250, 500, 1000, 2000, 4000, 8000, 16000, 32000, 64000, 128000
+        };
+    }
+    
+    Metrics::Counter CommandsAdded("mp710_commands_added_total", "Valid commands added to the device controller.");
+    Metrics::Counter CommandsInvalid("mp710_commands_invalid_total", "Commands dropped as invalid.");
+    Metrics::Counter CommandsCoalesced("mp710_commands_coalesced_total", "Commands replaced by a newer command for the same channel before execution.");
+    Metrics::Counter CommandsExecuted("mp710_commands_executed_total", "Device writes completed successfully.");
+    Metrics::Counter CommandsFailed("mp710_commands_failed_total", "Device writes which failed.");
+    Metrics::Counter WritesSuppressed("mp710_writes_suppressed_total", "Writes skipped because the channel already had the value.");
+    
+    Metrics::Gauge PendingChannels("mp710_pending_channels", "Channels with commands waiting for the worker.");
+    Metrics::Gauge CommandsInProgress("mp710_commands_in_progress", "Commands taken by the worker and not completed yet, including fades.");
+    
+    Metrics::Gauge TransfersInFlight("mp710_usb_transfers_in_flight", "USB transfers submitted and not completed yet.");
+    Metrics::Counter TransferFailures("mp710_usb_transfer_failures_total", "USB transfers which failed to submit or complete.");
+    Metrics::Counter DeviceReopens("mp710_usb_device_reopens_total", "Device reopens after a transfer error.");
+    Metrics::Histogram TransferLatency("mp710_usb_transfer_latency_seconds", "Time from USB transfer submission to completion.",
+                                       TRANSFER_LATENCY_BOUNDS_US,
+                                       sizeof(TRANSFER_LATENCY_BOUNDS_US) / sizeof(TRANSFER_LATENCY_BOUNDS_US[0]),
+                                       1e-6);
+}
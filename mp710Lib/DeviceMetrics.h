@@ -0,0 +1,48 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef DEVICEMETRICS_H
+#define DEVICEMETRICS_H
+
+#include "../metrics/Metrics.h"
+
+// Process wide metrics of DeviceController and its backends.
+namespace DeviceMetrics {
+    extern Metrics::Counter CommandsAdded;
+    extern Metrics::Counter CommandsInvalid;
+    // Replaced by a newer command for the same channel before they were executed.
+    extern Metrics::Counter CommandsCoalesced;
+    extern Metrics::Counter CommandsExecuted;
+    extern Metrics::Counter CommandsFailed;
+    extern Metrics::Counter WritesSuppressed;
+    
+    // Updated by the worker thread on every loop iteration.
+    extern Metrics::Gauge PendingChannels;
+    extern Metrics::Gauge CommandsInProgress;
+    
+    extern Metrics::Gauge TransfersInFlight;
+    extern Metrics::Counter TransferFailures;
+    extern Metrics::Counter DeviceReopens;
+    // Microseconds from submission to completion.
+    extern Metrics::Histogram TransferLatency;
+}
+
+#endif // DEVICEMETRICS_H
@@ -0,0 +1,179 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "SimulatedBackend.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <poll.h>
+#include <time.h>
+
+#include "DeviceMetrics.h"
+#include "../tracer/Tracer.h"
+
+const unsigned SimulatedBackend::DEFAULT_LATENCY_US = 1000;
+
+SimulatedBackend::SimulatedBackend(size_t maxInFlight, std::chrono::microseconds latency, double failureRate)
+  : _maxInFlight(std::max<size_t>(maxInFlight, 1)),
+  _latency(latency),
+  _failureRate(failureRate),
+  _isOpen(false),
+  _failureDistribution(0.0, 1.0),
+  _transfersCount(0)
+{
+  for (auto& channelValue : _channelValues) {
+    channelValue = 0;
+  }
+}
+
+void SimulatedBackend::Start(CompletionHandler completionHandler)
+{
+  _completionHandler = completionHandler;
+  _busyUntil = std::chrono::steady_clock::now();
+}
+
+void SimulatedBackend::Stop()
+{
+  // Pending transfers are cancelled like in the real device.
+  while (!_transfers.empty()) {
+    Transfer transfer = _transfers.front();
+    _transfers.pop_front();
+    
+    _completionHandler(false, transfer.Command);
+  }
+  
+  _isOpen = false;
+}
+
+bool SimulatedBackend::IsOpen() const
+{
+  return _isOpen;
+}
+
+bool SimulatedBackend::CanSubmit() const
+{
+  return _transfers.size() < _maxInFlight;
+}
+
+size_t SimulatedBackend::GetInFlight() const
+{
+  return _transfers.size();
+}
+
+bool SimulatedBackend::Submit(const DeviceController::Command& command)
+{
+  if (!CanSubmit()) {
+    return false;
+  }
+  
+  _isOpen = true;
+  
+  Transfer transfer;
+  transfer.Command = command;
+  
+  ControlMessage msg(command.ChannelIdx, command.Param);
+  std::copy(msg.GetData(), msg.GetData() + ControlMessage::SIZE, transfer.Data);
+  
+  // Control transfers share one endpoint, so they are completed one after another.
+  transfer.SubmitTime = std::chrono::steady_clock::now();
+  _busyUntil = std::max(_busyUntil, transfer.SubmitTime) + _latency;
+  transfer.Deadline = _busyUntil;
+  transfer.IsFailed = _failureRate > 0.0 && _failureDistribution(_random) < _failureRate;
+  
+  _transfers.push_back(transfer);
+  DeviceMetrics::TransfersInFlight.Set(_transfers.size());
+  
+  return true;
+}
+
+void SimulatedBackend::WaitForEvents(int wakeupFd, int timeoutMs)
+{
+  std::chrono::steady_clock::duration timeout = std::chrono::milliseconds(timeoutMs);
+  
+  if (!_transfers.empty()) {
+    std::chrono::steady_clock::duration transferTimeout = _transfers.front().Deadline - std::chrono::steady_clock::now();
+    transferTimeout = std::max(transferTimeout, std::chrono::steady_clock::duration::zero());
+    
+    if (timeoutMs < 0 || transferTimeout < timeout) {
+      timeout = transferTimeout;
+    }
+  }
+  
+  timespec pollTimeout;
+  timespec* pollTimeoutPtr = nullptr;
+  if (timeoutMs >= 0 || !_transfers.empty()) {
+    std::chrono::nanoseconds timeoutNs = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+    pollTimeout.tv_sec = timeoutNs.count() / 1000000000;
+    pollTimeout.tv_nsec = timeoutNs.count() % 1000000000;
+    pollTimeoutPtr = &pollTimeout;
+  }
+  
+  pollfd wakeupPollFd = {wakeupFd, POLLIN, 0};
+  if (ppoll(&wakeupPollFd, (wakeupFd >= 0) ? 1 : 0, pollTimeoutPtr, nullptr) < 0 && errno != EINTR) {
+    TRACER_ERRNO(Tracer::CATEGORY_USB, "Failed to poll simulated device events.\n");
+  }
+  
+  CompleteDueTransfers();
+}
+
+unsigned SimulatedBackend::GetChannelValue(unsigned channelIdx) const
+{
+  return (channelIdx < _channelValues.size()) ? _channelValues[channelIdx].load() : 0;
+}
+
+uint32_t SimulatedBackend::GetTransfersCount() const
+{
+  return _transfersCount;
+}
+
+void SimulatedBackend::CompleteDueTransfers()
+{
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  
+  while (!_transfers.empty() && _transfers.front().Deadline <= now) {
+    Transfer transfer = _transfers.front();
+    _transfers.pop_front();
+    
+    ++_transfersCount;
+    
+    DeviceMetrics::TransferLatency.Observe(std::chrono::duration_cast<std::chrono::microseconds>(now - transfer.SubmitTime).count());
+    DeviceMetrics::TransfersInFlight.Set(_transfers.size());
+    
+    unsigned channelIdx = 0;
+    unsigned brightness = 0;
+    bool result = !transfer.IsFailed &&
+                  ControlMessage::Decode(transfer.Data, ControlMessage::SIZE, channelIdx, brightness) &&
+                  channelIdx < _channelValues.size();
+    
+    if (result) {
+      _channelValues[channelIdx] = brightness;
+      TRACER_EVENT(Tracer::LEVEL_TRACE, Tracer::CATEGORY_USB, "Simulated transfer: channel %u, value %u.\n",
+                   channelIdx, brightness);
+    }
+    else {
+      TRACER_WARN(Tracer::CATEGORY_USB, "Simulated transfer failed.\n");
+      DeviceMetrics::TransferFailures.Increment();
+      _isOpen = false;
+    }
+    
+    _completionHandler(result, transfer.Command);
+  }
+}
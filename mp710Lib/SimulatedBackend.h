@@ -0,0 +1,89 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef SIMULATEDBACKEND_H
+#define SIMULATEDBACKEND_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <random>
+
+#include "ControlMessage.h"
+#include "DeviceBackend.h"
+
+// In-process model of MP710 for benchmarking without the device. Transfers
+// are decoded like the device does and completed one after another, each
+// taking the configured latency. A failed transfer disconnects the device
+// until the next Submit() reopens it.
+class SimulatedBackend : public DeviceBackend {
+public:
+    
+    static const unsigned DEFAULT_LATENCY_US;
+    
+    explicit SimulatedBackend(size_t maxInFlight = DeviceController::DEFAULT_TRANSFERS_IN_FLIGHT,
+                              std::chrono::microseconds latency = std::chrono::microseconds(DEFAULT_LATENCY_US),
+                              double failureRate = 0.0);
+    
+    void Start(CompletionHandler completionHandler) override;
+    void Stop() override;
+    
+    bool IsOpen() const override;
+    bool CanSubmit() const override;
+    size_t GetInFlight() const override;
+    bool Submit(const DeviceController::Command& command) override;
+    void WaitForEvents(int wakeupFd, int timeoutMs) override;
+    
+    // Can be called from any thread.
+    unsigned GetChannelValue(unsigned channelIdx) const;
+    uint32_t GetTransfersCount() const;
+    
+    SimulatedBackend(const SimulatedBackend&) = delete;
+    SimulatedBackend& operator=(const SimulatedBackend&) = delete;
+    
+private:
+    
+    struct Transfer
+    {
+        DeviceController::Command Command;
+        unsigned char Data[ControlMessage::SIZE];
+        std::chrono::steady_clock::time_point SubmitTime;
+        std::chrono::steady_clock::time_point Deadline;
+        bool IsFailed;
+    };
+    
+    void CompleteDueTransfers();
+    
+    const size_t _maxInFlight;
+    const std::chrono::microseconds _latency;
+    const double _failureRate;
+    bool _isOpen;
+    std::deque<Transfer> _transfers;
+    std::chrono::steady_clock::time_point _busyUntil;
+    std::minstd_rand _random;
+    std::uniform_real_distribution<double> _failureDistribution;
+    std::array<std::atomic<unsigned>, DeviceController::CHANNELS_NUMBER> _channelValues;
+    std::atomic<uint32_t> _transfersCount;
+    CompletionHandler _completionHandler;
+};
+
+#endif // SIMULATEDBACKEND_H
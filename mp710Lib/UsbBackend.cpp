@@ -0,0 +1,461 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "UsbBackend.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <sys/time.h>
+#include <libusb-1.0/libusb.h>
+
+#include "DeviceMetrics.h"
+#include "../tracer/Tracer.h"
+
+namespace {
+  const uint16_t DEV_VID = 0x16c0;
+  const uint16_t DEV_PID = 0x05df;
+  const int DEV_CONFIG = 1;
+  const int DEV_INTF = 0;
+  unsigned char EP_IN = 0x81;
+  const unsigned TRANSFER_TIMEOUT_MS = 100;
+}
+
+static_assert(LIBUSB_CONTROL_SETUP_SIZE == 8, "Unexpected size of control setup packet");
+
+// int main1(int argc, char **argv) {
+// 
+//   // Register handler for CTRL+C
+//   if (signal(SIGINT, sigIntHandler) == SIG_ERR) {
+//     Tracer::Log("Failed to setup SIGINT handler.\n");
+//   }
+//     
+//   // Register handler for termination
+//   if (signal(SIGTERM, sigIntHandler) == SIG_ERR) {
+//     Tracer::Log("Failed to setup SIGTERM handler.\n");
+//   }
+//   
+//   libusb_init(nullptr);
+//   libusb_set_debug(nullptr, 3);
+//   libusb_device_handle* handle = libusb_open_device_with_vid_pid(nullptr, DEV_VID, DEV_PID);
+//   if (handle == nullptr) {
+//       Tracer::Log("Failed to open device\n");
+//       libusb_exit(nullptr);
+//       return EXIT_FAILURE;
+//   }
+//   
+//   if (libusb_kernel_driver_active(handle, DEV_INTF))
+//   {
+//     libusb_detach_kernel_driver(handle, DEV_INTF);
+//   }
+//   
+//   int ret;
+//   if ((ret = libusb_set_configuration(handle, DEV_CONFIG)) < 0)
+//   {
+//     Tracer::Log("Failed to configure device, error: %i.\n", ret);
+//     libusb_close(handle);
+//     libusb_exit(nullptr);
+//     if (ret == LIBUSB_ERROR_BUSY)
+//     {
+//         Tracer::Log("Device is busy\n");
+//     }
+//     
+//     return EXIT_FAILURE;
+//   }
+//   
+//   if (libusb_claim_interface(handle,  DEV_INTF) < 0)
+//   {
+//     Tracer::Log("Failed to claim interface.\n");
+//     libusb_close(handle);
+//     libusb_exit(nullptr);
+//     return EXIT_FAILURE;
+//   }
+//   
+//   unsigned char buf[65];
+//         
+//   if (argc > 1)
+//   {
+//     const unsigned char OFF_BRIGHTNESS = 0x0;
+//     
+//     for (unsigned portIdx = 0; portIdx < 16; ++portIdx)
+//     {
+//       ControlMessage msg(portIdx, 0);
+//       ret = libusb_control_transfer(handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT,
+//                                     0x9, 0x300, 0, msg.GetData(), 8, 100);
+//       libusb_interrupt_transfer(handle, EP_IN, buf, 8, &ret, 100);
+//     }
+// 
+//     Tracer::Log("Set brightness to %d.\n", OFF_BRIGHTNESS);
+//   }
+//   else 
+//   {
+//     for (unsigned brightness = 0; brightness <= 128; ++brightness)
+//     {
+//       for (unsigned portIdx = 0; portIdx < 16; ++portIdx)
+//       {
+//         ControlMessage msg(portIdx, brightness);
+//         ret = libusb_control_transfer(handle, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT,
+//                                       0x9, 0x300, 0, msg.GetData(), 8, 100);
+//         libusb_interrupt_transfer(handle, EP_IN, buf, 8, &ret, 100);
+//       }
+// 
+//       Tracer::Log("Set brightness to %d.\n", brightness);
+//       
+//       std::this_thread::sleep_for(std::chrono::seconds(15));
+//     }
+//   }
+//   
+//   libusb_attach_kernel_driver(handle, DEV_INTF);
+//   libusb_close(handle);
+//   libusb_exit(nullptr);  
+//   
+//   return EXIT_SUCCESS;
+// }
+
+UsbBackend::UsbBackend(size_t maxInFlight)
+  : _maxInFlight(std::max<size_t>(maxInFlight, 1)),
+  _handle(nullptr),
+  _isBroken(false),
+  _inFlight(0),
+  _usbPollFdsCount(0)
+{
+}
+
+UsbBackend::~UsbBackend()
+{
+}
+
+void UsbBackend::Start(CompletionHandler completionHandler)
+{
+  _completionHandler = completionHandler;
+  
+  libusb_init(nullptr);
+  libusb_set_debug(nullptr, 3);
+  
+  _slots.resize(_maxInFlight);
+  _freeSlots.reserve(_slots.size());
+
+  for (auto& slot : _slots) {
+    slot.Backend = this;
+    slot.ControlTransfer = libusb_alloc_transfer(0);
+    slot.ReplyTransfer = libusb_alloc_transfer(0);
+
+    if (slot.ControlTransfer != nullptr && slot.ReplyTransfer != nullptr) {
+      _freeSlots.push_back(&slot);
+    }
+    else {
+      TRACER_ERROR(Tracer::CATEGORY_USB, "Failed to allocate USB transfer.\n");
+    }
+  }
+
+  // Track libusb file descriptors to poll them together with the wakeup descriptor.
+  const libusb_pollfd** usbPollFds = libusb_get_pollfds(nullptr);
+  if (usbPollFds != nullptr) {
+    for (const libusb_pollfd** it = usbPollFds; *it != nullptr; ++it) {
+      OnPollFdAdded((*it)->fd, (*it)->events, this);
+    }
+
+    libusb_free_pollfds(usbPollFds);
+  }
+
+  libusb_set_pollfd_notifiers(nullptr, &UsbBackend::OnPollFdAdded, &UsbBackend::OnPollFdRemoved, this);
+}
+
+void UsbBackend::Stop()
+{
+  Close();
+
+  libusb_set_pollfd_notifiers(nullptr, nullptr, nullptr, nullptr);
+
+  for (auto& slot : _slots) {
+    libusb_free_transfer(slot.ControlTransfer);
+    libusb_free_transfer(slot.ReplyTransfer);
+  }
+  
+  _freeSlots.clear();
+  _slots.clear();
+  _pollFds.clear();
+  _usbPollFdsCount = 0;
+  
+  libusb_exit(nullptr);
+}
+
+bool UsbBackend::IsOpen() const
+{
+  return _handle != nullptr;
+}
+
+bool UsbBackend::CanSubmit() const
+{
+  return !_freeSlots.empty() && !_isBroken;
+}
+
+size_t UsbBackend::GetInFlight() const
+{
+  return _inFlight;
+}
+
+bool UsbBackend::Open()
+{
+  if (IsOpen()) {
+    return true;
+  }
+
+  libusb_device_handle* handle = libusb_open_device_with_vid_pid(nullptr, DEV_VID, DEV_PID);
+  if (nullptr == handle) {
+    TRACER_ERROR(Tracer::CATEGORY_USB, "Failed to open device\n");
+    return false;
+  }
+
+  if (libusb_kernel_driver_active(handle, DEV_INTF))
+  {
+    libusb_detach_kernel_driver(handle, DEV_INTF);
+  }
+
+  int ret;
+  if ((ret = libusb_set_configuration(handle, DEV_CONFIG)) < 0)
+  {
+    TRACER_ERROR(Tracer::CATEGORY_USB, "Failed to configure device, error: %i.\n", ret);
+    if (ret == LIBUSB_ERROR_BUSY)
+    {
+        TRACER_WARN(Tracer::CATEGORY_USB, "Device is busy\n");
+    }
+
+    libusb_close(handle);
+    return false;
+  }
+
+  if (libusb_claim_interface(handle, DEV_INTF) < 0)
+  {
+    TRACER_ERROR(Tracer::CATEGORY_USB, "Failed to claim interface.\n");
+
+    libusb_close(handle);
+    return false;
+  }
+
+  _handle = handle;
+  _isBroken = false;
+
+  return true;
+}
+
+void UsbBackend::Close()
+{
+  if (!IsOpen()) {
+    return;
+  }
+
+  // Transfers must be finished before the handle is closed and the transfers
+  // are freed. A control transfer completed meanwhile starts a reply, so the
+  // cancelling is repeated until nothing is in flight.
+  while (GetInFlight() != 0) {
+    for (auto& slot : _slots) {
+      if (slot.IsBusy) {
+        libusb_cancel_transfer(slot.IsReplyPending ? slot.ReplyTransfer : slot.ControlTransfer);
+      }
+    }
+
+    ReapEvents(TRANSFER_TIMEOUT_MS);
+  }
+
+  libusb_release_interface(_handle, DEV_INTF);
+  libusb_attach_kernel_driver(_handle, DEV_INTF);
+  libusb_close(_handle);
+
+  _handle = nullptr;
+  // The next Submit() reopens the device.
+  _isBroken = false;
+}
+
+bool UsbBackend::Submit(const DeviceController::Command& command)
+{
+  if (!CanSubmit() || !Open()) {
+    return false;
+  }
+
+  TransferSlot* slot = _freeSlots.back();
+  slot->Command = command;
+
+  int ret = SubmitControl(slot);
+
+  if ((ret == LIBUSB_ERROR_NO_DEVICE || ret == LIBUSB_ERROR_IO) && GetInFlight() == 0) {
+    // The device was replugged or reset, so reopen it and retry once.
+    TRACER_WARN(Tracer::CATEGORY_USB, "Transfer failed, error: %i. Reopening device.\n", ret);
+    DeviceMetrics::DeviceReopens.Increment();
+
+    Close();
+    if (!Open()) {
+      return false;
+    }
+
+    ret = SubmitControl(slot);
+  }
+
+  if (ret < 0) {
+    TRACER_ERROR(Tracer::CATEGORY_USB, "Failed to submit transfer, error: %i.\n", ret);
+    DeviceMetrics::TransferFailures.Increment();
+    return false;
+  }
+
+  _freeSlots.pop_back();
+  slot->IsBusy = true;
+  slot->SubmitTime = std::chrono::steady_clock::now();
+  ++_inFlight;
+  DeviceMetrics::TransfersInFlight.Set(_inFlight);
+
+  TRACER_EVENT(Tracer::LEVEL_TRACE, Tracer::CATEGORY_USB, "Submitted transfer: channel %u, value %u, in flight %u.\n",
+               command.ChannelIdx, command.Param, static_cast<unsigned>(_inFlight));
+
+  return true;
+}
+
+void UsbBackend::WaitForEvents(int wakeupFd, int timeoutMs)
+{
+  _pollFds.resize(_usbPollFdsCount);
+  if (wakeupFd >= 0) {
+    pollfd wakeupPollFd = {wakeupFd, POLLIN, 0};
+    _pollFds.push_back(wakeupPollFd);
+  }
+
+  int pollTimeoutMs = timeoutMs;
+  timeval tv;
+  if (libusb_get_next_timeout(nullptr, &tv) == 1) {
+    int usbTimeoutMs = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+    if (pollTimeoutMs < 0 || usbTimeoutMs < pollTimeoutMs) {
+      pollTimeoutMs = usbTimeoutMs;
+    }
+  }
+
+  if (poll(_pollFds.data(), _pollFds.size(), pollTimeoutMs) < 0 && errno != EINTR) {
+    TRACER_ERRNO(Tracer::CATEGORY_USB, "Failed to poll device events.\n");
+  }
+
+  ReapEvents(0);
+
+  if (_isBroken && GetInFlight() == 0) {
+    Close();
+  }
+}
+
+void UsbBackend::ReapEvents(int timeoutMs)
+{
+  timeval tv;
+  tv.tv_sec = timeoutMs / 1000;
+  tv.tv_usec = (timeoutMs % 1000) * 1000;
+
+  libusb_handle_events_timeout_completed(nullptr, &tv, nullptr);
+}
+
+int UsbBackend::SubmitControl(TransferSlot* slot)
+{
+  ControlMessage msg(slot->Command.ChannelIdx, slot->Command.Param);
+
+  libusb_fill_control_setup(slot->ControlBuffer, LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT,
+                            0x9, 0x300, 0, ControlMessage::SIZE);
+  std::copy(msg.GetData(), msg.GetData() + ControlMessage::SIZE, slot->ControlBuffer + LIBUSB_CONTROL_SETUP_SIZE);
+
+  libusb_fill_control_transfer(slot->ControlTransfer, _handle, slot->ControlBuffer, &UsbBackend::OnControlDone,
+                               slot, TRANSFER_TIMEOUT_MS);
+
+  slot->IsReplyPending = false;
+
+  return libusb_submit_transfer(slot->ControlTransfer);
+}
+
+void UsbBackend::OnControlDone(libusb_transfer* transfer)
+{
+  TransferSlot* slot = reinterpret_cast<TransferSlot*>(transfer->user_data);
+  UsbBackend* backend = slot->Backend;
+
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+    TRACER_WARN(Tracer::CATEGORY_USB, "Control transfer failed, status: %i.\n", static_cast<int>(transfer->status));
+
+    if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE || transfer->status == LIBUSB_TRANSFER_ERROR) {
+      backend->_isBroken = true;
+    }
+
+    backend->Release(slot, false);
+    return;
+  }
+
+  // The device answers with a report which has to be read out.
+  libusb_fill_interrupt_transfer(slot->ReplyTransfer, backend->_handle, EP_IN, slot->ReplyBuffer, ControlMessage::SIZE,
+                                 &UsbBackend::OnReplyDone, slot, TRANSFER_TIMEOUT_MS);
+
+  slot->IsReplyPending = true;
+
+  if (libusb_submit_transfer(slot->ReplyTransfer) < 0) {
+    backend->Release(slot, true);
+  }
+}
+
+void UsbBackend::OnReplyDone(libusb_transfer* transfer)
+{
+  TransferSlot* slot = reinterpret_cast<TransferSlot*>(transfer->user_data);
+  UsbBackend* backend = slot->Backend;
+
+  // The reply is not used, so only a lost device is reported.
+  if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+    backend->_isBroken = true;
+  }
+
+  backend->Release(slot, true);
+}
+
+void UsbBackend::Release(TransferSlot* slot, bool result)
+{
+  slot->IsBusy = false;
+  slot->IsReplyPending = false;
+  _freeSlots.push_back(slot);
+  --_inFlight;
+
+  const std::chrono::steady_clock::duration latency = std::chrono::steady_clock::now() - slot->SubmitTime;
+  DeviceMetrics::TransferLatency.Observe(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+  DeviceMetrics::TransfersInFlight.Set(_inFlight);
+  if (!result) {
+    DeviceMetrics::TransferFailures.Increment();
+  }
+
+  TRACER_EVENT(Tracer::LEVEL_TRACE, Tracer::CATEGORY_USB, "Completed transfer [%u]: channel %u, value %u, in flight %u.\n",
+               static_cast<unsigned>(result), slot->Command.ChannelIdx, slot->Command.Param, static_cast<unsigned>(_inFlight));
+
+  _completionHandler(result, slot->Command);
+}
+
+void UsbBackend::OnPollFdAdded(int fd, short events, void* userData)
+{
+  UsbBackend* backend = reinterpret_cast<UsbBackend*>(userData);
+
+  pollfd usbPollFd = {fd, events, 0};
+  backend->_pollFds.resize(backend->_usbPollFdsCount);
+  backend->_pollFds.push_back(usbPollFd);
+  backend->_usbPollFdsCount = backend->_pollFds.size();
+}
+
+void UsbBackend::OnPollFdRemoved(int fd, void* userData)
+{
+  UsbBackend* backend = reinterpret_cast<UsbBackend*>(userData);
+
+  backend->_pollFds.resize(backend->_usbPollFdsCount);
+  backend->_pollFds.erase(std::remove_if(backend->_pollFds.begin(), backend->_pollFds.end(),
+                                         [fd](const pollfd& item) { return item.fd == fd; }),
+                          backend->_pollFds.end());
+  backend->_usbPollFdsCount = backend->_pollFds.size();
+}
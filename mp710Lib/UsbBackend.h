@@ -0,0 +1,98 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef USBBACKEND_H
+#define USBBACKEND_H
+
+#include <chrono>
+#include <vector>
+#include <poll.h>
+
+#include "ControlMessage.h"
+#include "DeviceBackend.h"
+
+struct libusb_device_handle;
+struct libusb_transfer;
+
+// Long-lived libusb connection to the device, so the device is opened and
+// claimed once instead of for every command. Commands are sent
+// asynchronously: up to maxInFlight control transfers are submitted
+// back-to-back and their completions are reaped by WaitForEvents().
+class UsbBackend : public DeviceBackend {
+public:
+    
+    explicit UsbBackend(size_t maxInFlight = DeviceController::DEFAULT_TRANSFERS_IN_FLIGHT);
+    ~UsbBackend();
+    
+    void Start(CompletionHandler completionHandler) override;
+    void Stop() override;
+    
+    bool IsOpen() const override;
+    bool CanSubmit() const override;
+    size_t GetInFlight() const override;
+    bool Submit(const DeviceController::Command& command) override;
+    void WaitForEvents(int wakeupFd, int timeoutMs) override;
+    
+    UsbBackend(const UsbBackend&) = delete;
+    UsbBackend& operator=(const UsbBackend&) = delete;
+    
+private:
+    
+    struct TransferSlot
+    {
+        UsbBackend* Backend;
+        libusb_transfer* ControlTransfer;
+        libusb_transfer* ReplyTransfer;
+        bool IsBusy;
+        bool IsReplyPending;
+        DeviceController::Command Command;
+        std::chrono::steady_clock::time_point SubmitTime;
+        unsigned char ControlBuffer[8 + ControlMessage::SIZE];   // setup packet followed by the message
+        unsigned char ReplyBuffer[ControlMessage::SIZE];
+        
+        TransferSlot()
+          : Backend(nullptr), ControlTransfer(nullptr), ReplyTransfer(nullptr), IsBusy(false), IsReplyPending(false)
+        { }
+    };
+    
+    bool Open();
+    void Close();
+    void ReapEvents(int timeoutMs);
+    int SubmitControl(TransferSlot* slot);
+    void Release(TransferSlot* slot, bool result);
+    
+    static void OnControlDone(libusb_transfer* transfer);
+    static void OnReplyDone(libusb_transfer* transfer);
+    static void OnPollFdAdded(int fd, short events, void* userData);
+    static void OnPollFdRemoved(int fd, void* userData);
+    
+    const size_t _maxInFlight;
+    libusb_device_handle* _handle;
+    bool _isBroken;
+    size_t _inFlight;
+    std::vector<TransferSlot> _slots;
+    std::vector<TransferSlot*> _freeSlots;
+    std::vector<pollfd> _pollFds;        // libusb descriptors followed by the wakeup descriptor
+    size_t _usbPollFdsCount;
+    CompletionHandler _completionHandler;
+};
+
+#endif // USBBACKEND_H
@@ -24,6 +24,7 @@
 #include <signal.h>
 #include <getopt.h>
 #include <atomic>
+#include <vector>
 #include <cstdio>
 
 #include "../tracer/Tracer.h"
@@ -43,6 +44,8 @@ int main(int argc, char **argv) {
   signal(SIGTERM, SignalsHandler);
   signal(SIGINT, SignalsHandler);
   
+  Tracer::StartAsync();
+  
   if (1 == argc) {
     const std::chrono::seconds SUNRISE_DURATION(60 * 30);
     
@@ -52,6 +55,8 @@ int main(int argc, char **argv) {
     SwitchOff();
   }
   
+  Tracer::StopAsync();
+  
   return 0;
 }
 
@@ -60,7 +65,7 @@ namespace {
   std::atomic<bool> NeedToStopPolling(false);
   
   void SignalsHandler(int signal) {
-      Tracer::Log("Interrupted by signal %i.\n", signal);
+      TRACER_INFO(Tracer::CATEGORY_GENERAL, "Interrupted by signal %i.\n", signal);
       NeedToStopPolling = true;
   }
   
@@ -69,52 +74,56 @@ namespace {
   }
   
   void OnDeviceUpdate(bool result, DeviceController::CommandTypesEnum type, unsigned channelIdx, unsigned param) {
-    Tracer::Log("Executed [%u] command %u at channel %u with param %u.\n",
-                static_cast<unsigned>(result),
-                static_cast<unsigned>(type),
-                static_cast<unsigned>(channelIdx),
-                static_cast<unsigned>(param));
+    TRACER_DEBUG(Tracer::CATEGORY_GENERAL, "Executed [%u] command %u at channel %u with param %u.\n",
+                 static_cast<unsigned>(result),
+                 static_cast<unsigned>(type),
+                 static_cast<unsigned>(channelIdx),
+                 static_cast<unsigned>(param));
   }   
   
-  const size_t MAX_QUEUE_SIZE = 100;
   const unsigned RED_CHANNEL_IDX = 14;
   const unsigned GREEN_CHANNEL_IDX = 13;
   const unsigned BLUE_CHANNEL_IDX = 12;
   
   void SwitchOff() {
-    DeviceController deviceController(MAX_QUEUE_SIZE, OnDeviceUpdate);
+    DeviceController deviceController(OnDeviceUpdate);
 
+    DeviceController::Command commands[DeviceController::CHANNELS_NUMBER];
     for (unsigned channelIdx = 0; channelIdx < DeviceController::CHANNELS_NUMBER; ++channelIdx) {
-      deviceController.AddCommand(DeviceController::SET_BRIGHTNESS, channelIdx, 0);
+      commands[channelIdx] = DeviceController::Command(DeviceController::SET_BRIGHTNESS, channelIdx, 0);
     }
 
+    deviceController.AddCommands(commands, DeviceController::CHANNELS_NUMBER);
+
     if (deviceController.WaitForCommands(std::chrono::seconds(15))) {
-      Tracer::Log("All channels are switched off.\n");
+      TRACER_INFO(Tracer::CATEGORY_GENERAL, "All channels are switched off.\n");
     }
     else {
-      Tracer::Log("Failed to switch off.\n");
+      TRACER_ERROR(Tracer::CATEGORY_GENERAL, "Failed to switch off.\n");
     }
   }
   
   void Sunrise(std::chrono::seconds duration) {
-    DeviceController deviceController(MAX_QUEUE_SIZE, OnDeviceUpdate);
+    DeviceController deviceController(OnDeviceUpdate);
     
-    const std::chrono::milliseconds durationMs(duration);
+    const unsigned durationMs = std::chrono::milliseconds(duration).count();
     const std::vector<unsigned> channels {RED_CHANNEL_IDX, GREEN_CHANNEL_IDX, BLUE_CHANNEL_IDX};
-    const std::chrono::milliseconds stepDuration = durationMs / DeviceController::BRIGHTNESS_MAX / channels.size();
 
-    for (unsigned brightness = 0; brightness <= DeviceController::BRIGHTNESS_MAX; ++brightness) {
-      
-      for (auto channel : channels) {
-        if (IsSignalRaised()) {
-          return;
-        }
-        
-        deviceController.AddCommand(DeviceController::SET_BRIGHTNESS, channel, brightness);
-        std::this_thread::sleep_for(stepDuration);
-      }
+    // The device controller interpolates the fade, so one command per channel is enough.
+    std::vector<DeviceController::Command> commands;
+    for (auto channel : channels) {
+      commands.push_back(DeviceController::Command(DeviceController::FADE, channel, DeviceController::BRIGHTNESS_MAX,
+                                                   durationMs, DeviceController::EASE_LINEAR));
+    }
+    
+    deviceController.AddCommands(commands.data(), commands.size());
 
-    Tracer::Log("Sun is up.\n");
+    while (!deviceController.WaitForCommands(std::chrono::seconds(1))) {
+      if (IsSignalRaised()) {
+        return;
+      }
     }
+
+    TRACER_INFO(Tracer::CATEGORY_GENERAL, "Sun is up.\n");
   }
 }
@@ -0,0 +1,272 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "AssetCache.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "../tracer/Tracer.h"
+#include "HttpUtils.h"
+#include "EmbeddedAssets.h"
+
+namespace {
+    
+    const char GZIP_SUFFIX[] = ".gz";
+    const char INDEX_URI[] = "/index.html";
+    
+    // Versioned files (name-1.2.3.js) never change under the same URI.
+    const char VERSIONED_CACHE_CONTROL[] = "public, max-age=31536000, immutable";
+    const char DEFAULT_CACHE_CONTROL[] = "no-cache";
+    
+    bool EndsWith(const std::string& text, const char* suffix) {
+        const size_t suffixSize = strlen(suffix);
+        return text.size() >= suffixSize && text.compare(text.size() - suffixSize, suffixSize, suffix) == 0;
+    }
+    
+    // Returns nullptr for files that are not part of the web UI.
+    const char* GetContentType(const std::string& name) {
+        static const struct {
+            const char* Extension;
+            const char* ContentType;
+        } CONTENT_TYPES[] = {
+            {".html", "text/html; charset=utf-8"},
+            {".js", "application/javascript"},
+            {".css", "text/css"},
+            {".json", "application/json"},
+            {".png", "image/png"},
+            {".ico", "image/x-icon"},
+            {".svg", "image/svg+xml"}
+        };
+        
+        for (const auto& entry : CONTENT_TYPES) {
+            if (EndsWith(name, entry.Extension)) {
+                return entry.ContentType;
+            }
+        }
+        
+        return nullptr;
+    }
+    
+    bool IsVersioned(const std::string& name) {
+        // Looks for "<digit>.<digit>" in the file name.
+        const size_t nameStart = name.rfind('/') + 1;
+        for (size_t i = nameStart + 2; i < name.size(); ++i) {
+            if (name[i - 1] == '.' && isdigit(name[i - 2]) && isdigit(name[i])) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool ReadFile(const std::string& path, std::vector<char>& data) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (nullptr == file) {
+            return false;
+        }
+        
+        data.clear();
+        char buffer[4096];
+        size_t size = 0;
+        while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            data.insert(data.end(), buffer, buffer + size);
+        }
+        
+        const bool success = (ferror(file) == 0);
+        fclose(file);
+        
+        return success;
+    }
+    
+    std::string MakeETag(const std::vector<char>& data) {
+        // FNV-1a is enough to tell versions of the same file apart.
+        uint64_t hash = 14695981039346656037ULL;
+        for (char ch : data) {
+            hash = (hash ^ static_cast<uint8_t>(ch)) * 1099511628211ULL;
+        }
+        
+        char etag[32];
+        snprintf(etag, sizeof(etag), "%016llx", static_cast<unsigned long long>(hash));
+        
+        return etag;
+    }
+    
+    bool HeaderContains(http_message* hm, const char* name, const char* value) {
+        const mg_str* header = mg_get_http_header(hm, name);
+        if (nullptr == header) {
+            return false;
+        }
+        
+        const size_t valueSize = strlen(value);
+        for (size_t i = 0; i + valueSize <= header->len; ++i) {
+            if (memcmp(header->p + i, value, valueSize) == 0) {
+                return true;
+            }
+        }
+        
+        return false;
+    }
+}
+
+bool AssetCache::LoadEmbedded() {
+    _assets.clear();
+    _fileContents.clear();
+    _totalSize = 0;
+    
+    for (size_t i = 0; i < EMBEDDED_ASSETS_COUNT; ++i) {
+        const EmbeddedAsset& embedded = EMBEDDED_ASSETS[i];
+        AddAsset(embedded.Uri,
+                 reinterpret_cast<const char*>(embedded.Data), embedded.Size,
+                 reinterpret_cast<const char*>(embedded.GzipData), embedded.GzipSize,
+                 embedded.ETag);
+    }
+    
+    TRACER_INFO(Tracer::CATEGORY_WEB, "Using %u embedded web assets, %u bytes.\n", static_cast<unsigned>(_assets.size()), static_cast<unsigned>(_totalSize));
+    
+    return !_assets.empty();
+}
+
+void AssetCache::AddAsset(const std::string& uri, const char* data, size_t size, const char* gzipData, size_t gzipSize, const std::string& etag) {
+    Asset& asset = _assets[uri];
+    
+    asset.ContentType = GetContentType(uri);
+    if (nullptr == asset.ContentType) {
+        asset.ContentType = "application/octet-stream";
+    }
+    asset.Data = data;
+    asset.Size = size;
+    asset.GzipData = gzipData;
+    asset.GzipSize = gzipSize;
+    asset.ETag = "\"" + etag + "\"";
+    asset.GzipETag = "\"" + etag + "-gz\"";
+    asset.IsVersioned = IsVersioned(uri);
+    
+    _totalSize += size + gzipSize;
+}
+
+bool AssetCache::Load(const char* rootDir) {
+    _assets.clear();
+    _fileContents.clear();
+    _totalSize = 0;
+    
+    std::string root(rootDir);
+    while (root.size() > 1 && root[root.size() - 1] == '/') {
+        root.resize(root.size() - 1);
+    }
+    
+    LoadDirectory(root, "");
+    
+    TRACER_INFO(Tracer::CATEGORY_WEB, "Cached %u web assets, %u bytes.\n", static_cast<unsigned>(_assets.size()), static_cast<unsigned>(_totalSize));
+    
+    return !_assets.empty();
+}
+
+void AssetCache::LoadDirectory(const std::string& dirPath, const std::string& uriPrefix) {
+    DIR* dir = opendir(dirPath.c_str());
+    if (nullptr == dir) {
+        TRACER_ERRNO(Tracer::CATEGORY_WEB, "Failed to open directory %s.\n", dirPath.c_str());
+        return;
+    }
+    
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        
+        const std::string path = dirPath + "/" + entry->d_name;
+        const std::string uri = uriPrefix + "/" + entry->d_name;
+        
+        struct stat fileStat;
+        if (stat(path.c_str(), &fileStat) != 0) {
+            continue;
+        }
+        
+        if (S_ISDIR(fileStat.st_mode)) {
+            LoadDirectory(path, uri);
+            continue;
+        }
+        
+        // Compressed variants are picked up together with their originals.
+        // Files of other types (e.g. build leftovers in the work dir) stay on disk.
+        if (!S_ISREG(fileStat.st_mode) || nullptr == GetContentType(uri)) {
+            continue;
+        }
+        
+        _fileContents.push_back(std::vector<char>());
+        std::vector<char>& data = _fileContents.back();
+        if (!ReadFile(path, data)) {
+            TRACER_ERRNO(Tracer::CATEGORY_WEB, "Failed to read %s.\n", path.c_str());
+            _fileContents.pop_back();
+            continue;
+        }
+        
+        _fileContents.push_back(std::vector<char>());
+        std::vector<char>& gzipData = _fileContents.back();
+        ReadFile(path + GZIP_SUFFIX, gzipData);
+        
+        AddAsset(uri, data.data(), data.size(), gzipData.empty() ? nullptr : gzipData.data(), gzipData.size(), MakeETag(data));
+    }
+    
+    closedir(dir);
+}
+
+bool AssetCache::Serve(mg_connection* nc, http_message* hm) const {
+    if (mg_vcmp(&hm->method, "GET") != 0 && mg_vcmp(&hm->method, "HEAD") != 0) {
+        return false;
+    }
+    
+    std::string uri(hm->uri.p, hm->uri.len);
+    if (uri == "/") {
+        uri = INDEX_URI;
+    }
+    
+    auto it = _assets.find(uri);
+    if (it == _assets.end()) {
+        return false;
+    }
+    
+    const Asset& asset = it->second;
+    
+    const bool useGzip = (asset.GzipData != nullptr) && HeaderContains(hm, "Accept-Encoding", "gzip");
+    const std::string& etag = useGzip ? asset.GzipETag : asset.ETag;
+    
+    char headers[256];
+    snprintf(headers, sizeof(headers), "ETag: %s\r\nCache-Control: %s\r\nVary: Accept-Encoding%s",
+             etag.c_str(),
+             asset.IsVersioned ? VERSIONED_CACHE_CONTROL : DEFAULT_CACHE_CONTROL,
+             useGzip ? "\r\nContent-Encoding: gzip" : "");
+    
+    if (HeaderContains(hm, "If-None-Match", etag.c_str())) {
+        HttpUtils::SendResponse(nc, hm, 304, asset.ContentType, nullptr, 0, headers);
+    }
+    else {
+        HttpUtils::SendResponse(nc, hm, 200, asset.ContentType,
+                                useGzip ? asset.GzipData : asset.Data,
+                                useGzip ? asset.GzipSize : asset.Size,
+                                headers);
+    }
+    
+    return true;
+}
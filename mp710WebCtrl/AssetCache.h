@@ -0,0 +1,75 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef ASSETCACHE_H
+#define ASSETCACHE_H
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../thirdparty/mongoose/mongoose.h"
+
+// Immutable in-memory copy of the web UI files, set up once at startup either
+// from the table compiled into the binary or from a directory. In the latter
+// case a "name.gz" file next to "name" is served to clients accepting gzip.
+// Responses carry strong ETags and answer If-None-Match with 304.
+class AssetCache {
+public:
+    
+    AssetCache()
+        : _totalSize(0)
+    { }
+    
+    // Uses EMBEDDED_ASSETS without copying.
+    bool LoadEmbedded();
+    
+    // Reads all files under rootDir. Returns false if nothing was loaded.
+    bool Load(const char* rootDir);
+    
+    // Answers GET and HEAD requests for cached files. Returns false if the URI is not cached.
+    bool Serve(mg_connection* nc, http_message* hm) const;
+    
+private:
+    
+    struct Asset
+    {
+        const char* ContentType;
+        const char* Data;
+        size_t Size;
+        const char* GzipData;
+        size_t GzipSize;
+        std::string ETag;
+        std::string GzipETag;
+        bool IsVersioned;
+    };
+    
+    void AddAsset(const std::string& uri, const char* data, size_t size, const char* gzipData, size_t gzipSize, const std::string& etag);
+    void LoadDirectory(const std::string& dirPath, const std::string& uriPrefix);
+    
+    std::map<std::string, Asset> _assets;
+    std::list<std::vector<char>> _fileContents;     // owns data of files read from disk
+    size_t _totalSize;
+};
+
+#endif // ASSETCACHE_H
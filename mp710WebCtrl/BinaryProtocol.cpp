@@ -0,0 +1,94 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "BinaryProtocol.h"
+
+namespace BinaryProtocol {
+    
+    const char NAME[] = "mp710.binary";
+    
+    namespace {
+        const uint8_t TYPE_NOT_SET = 0xFF;
+        
+        void WriteRecord(const DeviceController::Command& command, uint8_t* record) {
+            record[0] = (command.Type == DeviceController::NOT_SET) ? TYPE_NOT_SET : static_cast<uint8_t>(command.Type);
+            record[1] = static_cast<uint8_t>(command.ChannelIdx);
+            record[2] = static_cast<uint8_t>(command.Param);
+            record[3] = static_cast<uint8_t>(command.Easing);
+            
+            const uint32_t duration = command.Duration;
+            record[4] = static_cast<uint8_t>(duration);
+            record[5] = static_cast<uint8_t>(duration >> 8);
+            record[6] = static_cast<uint8_t>(duration >> 16);
+            record[7] = static_cast<uint8_t>(duration >> 24);
+        }
+        
+        void ReadRecord(const uint8_t* record, DeviceController::Command& command) {
+            command.Type = (record[0] == TYPE_NOT_SET) ? DeviceController::NOT_SET : static_cast<DeviceController::CommandTypesEnum>(record[0]);
+            command.ChannelIdx = record[1];
+            command.Param = record[2];
+            command.Easing = static_cast<DeviceController::EasingEnum>(record[3]);
+            command.Duration = static_cast<uint32_t>(record[4]) |
+                               static_cast<uint32_t>(record[5]) << 8 |
+                               static_cast<uint32_t>(record[6]) << 16 |
+                               static_cast<uint32_t>(record[7]) << 24;
+        }
+    }
+    
+    size_t Serialize(FrameKindEnum kind, const DeviceController::Command* commands, size_t count, uint8_t* buffer, size_t bufferSize) {
+        const size_t frameSize = HEADER_SIZE + RECORD_SIZE * count;
+        if (count > MAX_RECORDS || frameSize > bufferSize) {
+            return 0;
+        }
+        
+        buffer[0] = static_cast<uint8_t>(kind);
+        buffer[1] = static_cast<uint8_t>(count);
+        buffer[2] = 0;
+        buffer[3] = 0;
+        
+        for (size_t i = 0; i < count; ++i) {
+            WriteRecord(commands[i], buffer + HEADER_SIZE + RECORD_SIZE * i);
+        }
+        
+        return frameSize;
+    }
+    
+    bool Parse(const uint8_t* data, size_t size, DeviceController::Command* commands, size_t maxCount, size_t& count) {
+        if (size < HEADER_SIZE || data[0] != COMMANDS) {
+            return false;
+        }
+        
+        count = data[1];
+        if (count > maxCount || size != HEADER_SIZE + RECORD_SIZE * count) {
+            return false;
+        }
+        
+        for (size_t i = 0; i < count; ++i) {
+            const uint8_t* record = data + HEADER_SIZE + RECORD_SIZE * i;
+            if (record[3] > DeviceController::EASE_IN_OUT) {
+                return false;
+            }
+            ReadRecord(record, commands[i]);
+        }
+        
+        return true;
+    }
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef BINARYPROTOCOL_H
+#define BINARYPROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "../mp710Lib/DeviceController.h"
+
+// Websocket subprotocol with fixed-size little-endian records.
+// Every frame starts with a 4-byte header:
+//   [0] frame kind, [1] number of records, [2..3] reserved (0).
+// Each record takes 8 bytes:
+//   [0] command type (0xFF - not set), [1] channel index, [2] param,
+//   [3] easing, [4..7] duration in ms.
+namespace BinaryProtocol {
+    
+    extern const char NAME[];
+    
+    enum FrameKindEnum {
+        COMMANDS = 1,       // client to server
+        FULL_STATE = 2,     // server to client, all channels
+        DELTA_STATE = 3     // server to client, changed channels only
+    };
+    
+    static const size_t HEADER_SIZE = 4;
+    static const size_t RECORD_SIZE = 8;
+    static const size_t MAX_RECORDS = 255;
+    static const size_t STATE_FRAME_SIZE_MAX = HEADER_SIZE + RECORD_SIZE * DeviceController::CHANNELS_NUMBER;
+    
+    // Returns the frame size, 0 if buffer is too small.
+    size_t Serialize(FrameKindEnum kind, const DeviceController::Command* commands, size_t count, uint8_t* buffer, size_t bufferSize);
+    
+    // Decodes COMMANDS frame. Returns false for malformed frames.
+    bool Parse(const uint8_t* data, size_t size, DeviceController::Command* commands, size_t maxCount, size_t& count);
+}
+
+#endif // BINARYPROTOCOL_H
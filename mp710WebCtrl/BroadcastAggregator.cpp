@@ -0,0 +1,82 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "BroadcastAggregator.h"
+
+const unsigned BroadcastAggregator::DEFAULT_WINDOW_MS = 20;
+
+BroadcastAggregator::BroadcastAggregator(unsigned windowMs)
+    : _changedMask(0),
+    _window(std::chrono::milliseconds(windowMs))
+{
+}
+
+void BroadcastAggregator::SetWindow(unsigned windowMs) {
+    _window = std::chrono::milliseconds(windowMs);
+}
+
+void BroadcastAggregator::Add(const DeviceController::Command& command) {
+    if (command.ChannelIdx >= DeviceController::CHANNELS_NUMBER) {
+        return;
+    }
+    
+    // The window starts with the first change, later ones do not extend it.
+    if (0 == _changedMask) {
+        _deadline = Clock::now() + _window;
+    }
+    
+    _latest[command.ChannelIdx] = command;
+    _changedMask |= 1U << command.ChannelIdx;
+}
+
+int BroadcastAggregator::GetTimeoutMs(int maxTimeoutMs) const {
+    if (0 == _changedMask) {
+        return maxTimeoutMs;
+    }
+    
+    const Clock::duration left = _deadline - Clock::now();
+    if (left <= Clock::duration::zero()) {
+        return 0;
+    }
+    
+    // Round up so that poll does not wake just before the deadline.
+    const auto leftMs = std::chrono::duration_cast<std::chrono::milliseconds>(left + std::chrono::milliseconds(1) - Clock::duration(1)).count();
+    
+    return leftMs < maxTimeoutMs ? static_cast<int>(leftMs) : maxTimeoutMs;
+}
+
+bool BroadcastAggregator::IsDue() const {
+    return _changedMask != 0 && Clock::now() >= _deadline;
+}
+
+size_t BroadcastAggregator::Take(DeviceController::Command* commands) {
+    size_t count = 0;
+    
+    for (unsigned i = 0; i < DeviceController::CHANNELS_NUMBER; ++i) {
+        if ((_changedMask & (1U << i)) != 0) {
+            commands[count++] = _latest[i];
+        }
+    }
+    
+    _changedMask = 0;
+    
+    return count;
+}
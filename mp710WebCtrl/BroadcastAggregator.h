@@ -0,0 +1,62 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef BROADCASTAGGREGATOR_H
+#define BROADCASTAGGREGATOR_H
+
+#include <array>
+#include <chrono>
+
+#include "../mp710Lib/DeviceController.h"
+
+// Collects channel changes for a short window so that clients get one
+// combined delta frame instead of a frame per executed command.
+class BroadcastAggregator {
+public:
+    
+    static const unsigned DEFAULT_WINDOW_MS;
+    
+    explicit BroadcastAggregator(unsigned windowMs = DEFAULT_WINDOW_MS);
+    
+    // Zero window flushes on every poll iteration.
+    void SetWindow(unsigned windowMs);
+    
+    void Add(const DeviceController::Command& command);
+    
+    // Time left until the pending changes are due, capped by maxTimeoutMs.
+    int GetTimeoutMs(int maxTimeoutMs) const;
+    
+    bool IsDue() const;
+    
+    // Moves pending changes ordered by channel index to commands, returns the count.
+    size_t Take(DeviceController::Command* commands);
+    
+private:
+    
+    typedef std::chrono::steady_clock Clock;
+    
+    std::array<DeviceController::Command, DeviceController::CHANNELS_NUMBER> _latest;
+    uint32_t _changedMask;
+    Clock::duration _window;
+    Clock::time_point _deadline;
+};
+
+#endif // BROADCASTAGGREGATOR_H
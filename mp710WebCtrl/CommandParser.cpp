@@ -0,0 +1,233 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "CommandParser.h"
+
+#include <cstdint>
+
+namespace CommandParser {
+    
+    namespace {
+        
+        class Cursor {
+        public:
+            
+            Cursor(const char* data, size_t size)
+                : _begin(data), _pos(data), _end(data + size), _error(nullptr), _errorPos(data)
+            { }
+            
+            bool Failed() const {
+                return _error != nullptr;
+            }
+            
+            void Fail(const char* message, const char* pos) {
+                if (nullptr == _error) {
+                    _error = message;
+                    _errorPos = pos;
+                }
+            }
+            
+            void Fail(const char* message) {
+                Fail(message, _pos);
+            }
+            
+            void GetError(Error& error) const {
+                error.Message = _error;
+                error.Offset = _errorPos - _begin;
+            }
+            
+            const char* GetPos() const {
+                return _pos;
+            }
+            
+            bool AtEnd() {
+                SkipSpaces();
+                return _pos == _end;
+            }
+            
+            // Consumes ch if it is the next non-space character.
+            bool Accept(char ch) {
+                SkipSpaces();
+                if (_pos != _end && *_pos == ch) {
+                    ++_pos;
+                    return true;
+                }
+                return false;
+            }
+            
+            bool Expect(char ch, const char* message) {
+                if (!Accept(ch)) {
+                    Fail(message);
+                    return false;
+                }
+                return true;
+            }
+            
+            bool ReadNumber(uint32_t& value) {
+                SkipSpaces();
+                
+                const char* start = _pos;
+                uint64_t result = 0;
+                
+                while (_pos != _end && *_pos >= '0' && *_pos <= '9') {
+                    result = result * 10 + (*_pos - '0');
+                    if (result > UINT32_MAX) {
+                        Fail("number is too big", start);
+                        return false;
+                    }
+                    ++_pos;
+                }
+                
+                if (_pos == start) {
+                    Fail("number expected");
+                    return false;
+                }
+                
+                value = static_cast<uint32_t>(result);
+                return true;
+            }
+            
+        private:
+            
+            void SkipSpaces() {
+                while (_pos != _end && (*_pos == ' ' || *_pos == '\t' || *_pos == '\r' || *_pos == '\n')) {
+                    ++_pos;
+                }
+            }
+            
+            const char* _begin;
+            const char* _pos;
+            const char* _end;
+            const char* _error;
+            const char* _errorPos;
+        };
+        
+        bool ParseCommand(Cursor& cursor, DeviceController::Command& command) {
+            static const size_t FIELDS_MIN = 3;
+            static const size_t FIELDS_MAX = 5;
+            
+            const char* start = cursor.GetPos();
+            
+            if (!cursor.Expect('{', "'{' expected")) {
+                return false;
+            }
+            
+            uint32_t fields[FIELDS_MAX] = {0, 0, 0, 0, DeviceController::EASE_LINEAR};
+            size_t fieldsCount = 0;
+            
+            do {
+                if (fieldsCount == FIELDS_MAX) {
+                    cursor.Fail("too many fields");
+                    return false;
+                }
+                if (!cursor.ReadNumber(fields[fieldsCount++])) {
+                    return false;
+                }
+            } while (cursor.Accept(','));
+            
+            if (!cursor.Expect('}', "'}' expected")) {
+                return false;
+            }
+            
+            if (fieldsCount < FIELDS_MIN) {
+                cursor.Fail("too few fields", start);
+                return false;
+            }
+            
+            if (fields[0] > DeviceController::FADE || fields[4] > DeviceController::EASE_IN_OUT) {
+                cursor.Fail(fields[0] > DeviceController::FADE ? "unknown command type" : "unknown easing", start);
+                return false;
+            }
+            
+            command = DeviceController::Command(static_cast<DeviceController::CommandTypesEnum>(fields[0]),
+                                                fields[1],
+                                                fields[2],
+                                                fields[3],
+                                                static_cast<DeviceController::EasingEnum>(fields[4]));
+            
+            const char* error = Validate(command);
+            if (error != nullptr) {
+                cursor.Fail(error, start);
+                return false;
+            }
+            
+            return true;
+        }
+    }
+    
+    const char* Validate(const DeviceController::Command& command) {
+        if (command.Type != DeviceController::SET_BRIGHTNESS && command.Type != DeviceController::FADE) {
+            return "unknown command type";
+        }
+        if (command.ChannelIdx >= DeviceController::CHANNELS_NUMBER) {
+            return "channel index is out of range";
+        }
+        if (command.Param > DeviceController::BRIGHTNESS_MAX) {
+            return "brightness is out of range";
+        }
+        if (command.Duration > DeviceController::FADE_DURATION_MAX_MS) {
+            return "duration is out of range";
+        }
+        if (command.Easing > DeviceController::EASE_IN_OUT) {
+            return "unknown easing";
+        }
+        return nullptr;
+    }
+    
+    bool Parse(const char* data, size_t size, DeviceController::Command* commands, size_t maxCount, size_t& count, Error& error) {
+        Cursor cursor(data, size);
+        count = 0;
+        
+        if (cursor.Accept('[')) {
+            if (!cursor.Accept(']')) {
+                do {
+                    if (count == maxCount) {
+                        cursor.Fail("too many commands");
+                        break;
+                    }
+                    if (!ParseCommand(cursor, commands[count])) {
+                        break;
+                    }
+                    ++count;
+                } while (cursor.Accept(','));
+                
+                if (!cursor.Failed()) {
+                    cursor.Expect(']', "']' expected");
+                }
+            }
+        }
+        else if (maxCount > 0 && ParseCommand(cursor, commands[0])) {
+            count = 1;
+        }
+        
+        if (!cursor.Failed() && !cursor.AtEnd()) {
+            cursor.Fail("unexpected trailing data");
+        }
+        
+        if (cursor.Failed()) {
+            cursor.GetError(error);
+            count = 0;
+            return false;
+        }
+        
+        return true;
+    }
+}
@@ -0,0 +1,49 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef COMMANDPARSER_H
+#define COMMANDPARSER_H
+
+#include <cstddef>
+
+#include "../mp710Lib/DeviceController.h"
+
+// Single-pass parser of text websocket commands. Accepts one command
+//   {type, channelIdx, param[, durationMs[, easing]]}
+// or a batch of them in square brackets. The input is not NUL-terminated.
+namespace CommandParser {
+    
+    static const size_t MAX_COMMANDS = 64;
+    
+    struct Error
+    {
+        const char* Message;
+        size_t Offset;
+    };
+    
+    // Returns nullptr if the command may be passed to DeviceController, the reason otherwise.
+    const char* Validate(const DeviceController::Command& command);
+    
+    // Either all commands are valid and stored or none, error tells why.
+    bool Parse(const char* data, size_t size, DeviceController::Command* commands, size_t maxCount, size_t& count, Error& error);
+}
+
+#endif // COMMANDPARSER_H
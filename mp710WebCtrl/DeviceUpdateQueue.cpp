@@ -0,0 +1,108 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "DeviceUpdateQueue.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../tracer/Tracer.h"
+
+DeviceUpdateQueue::DeviceUpdateQueue()
+    : _head(0),
+    _tail(0),
+    _isSignalled(false),
+    _isOverflowed(false),
+    _signalSocket(-1)
+{
+}
+
+DeviceUpdateQueue::~DeviceUpdateQueue() {
+    // The other end belongs to mongoose and is closed by mg_mgr_free().
+    if (_signalSocket >= 0) {
+        close(_signalSocket);
+    }
+}
+
+bool DeviceUpdateQueue::Attach(mg_mgr* mgr, mg_event_handler_t handler, void* userData) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sockets) != 0) {
+        TRACER_ERRNO(Tracer::CATEGORY_WEB, "Failed to create update socket pair.\n");
+        return false;
+    }
+    
+    mg_connection* nc = mg_add_sock(mgr, sockets[1], handler);
+    if (nullptr == nc) {
+        TRACER_ERROR(Tracer::CATEGORY_WEB, "Failed to register update socket.\n");
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+    
+    nc->user_data = userData;
+    _signalSocket = sockets[0];
+    
+    return true;
+}
+
+void DeviceUpdateQueue::Push(const DeviceController::Command& command) {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    
+    if (tail - _head.load(std::memory_order_acquire) == CAPACITY) {
+        _isOverflowed.store(true, std::memory_order_release);
+    }
+    else {
+        _items[tail % CAPACITY] = command;
+        _tail.store(tail + 1, std::memory_order_release);
+    }
+    
+    // One pending signal is enough until the event loop starts draining.
+    if (_signalSocket >= 0 && !_isSignalled.exchange(true)) {
+        const char signal = 1;
+        if (send(_signalSocket, &signal, sizeof(signal), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            _isSignalled = false;
+        }
+    }
+}
+
+void DeviceUpdateQueue::OnSignalled(mg_connection* nc) {
+    mbuf_remove(&nc->recv_mbuf, nc->recv_mbuf.len);
+    
+    // Items pushed after this point signal again.
+    _isSignalled = false;
+}
+
+bool DeviceUpdateQueue::Pop(DeviceController::Command& command) {
+    const size_t head = _head.load(std::memory_order_relaxed);
+    
+    if (head == _tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    
+    command = _items[head % CAPACITY];
+    _head.store(head + 1, std::memory_order_release);
+    
+    return true;
+}
+
+bool DeviceUpdateQueue::TakeOverflow() {
+    return _isOverflowed.exchange(false, std::memory_order_acq_rel);
+}
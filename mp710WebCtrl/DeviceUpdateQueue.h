@@ -0,0 +1,67 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef DEVICEUPDATEQUEUE_H
+#define DEVICEUPDATEQUEUE_H
+
+#include <array>
+#include <atomic>
+
+#include "../thirdparty/mongoose/mongoose.h"
+#include "../mp710Lib/DeviceController.h"
+
+// Passes executed commands from the DeviceController worker thread to the
+// mongoose event loop. Push() is lock-free and wakes the event loop through a
+// socketpair registered in mongoose; the handler then drains the queue on the
+// poll thread. If the queue overflows, the consumer should resend full state.
+class DeviceUpdateQueue {
+public:
+    
+    DeviceUpdateQueue();
+    ~DeviceUpdateQueue();
+    
+    // The handler gets MG_EV_RECV on the poll thread and has to call OnSignalled().
+    bool Attach(mg_mgr* mgr, mg_event_handler_t handler, void* userData);
+    
+    // Worker thread only.
+    void Push(const DeviceController::Command& command);
+    
+    // Event loop thread only.
+    void OnSignalled(mg_connection* nc);
+    bool Pop(DeviceController::Command& command);
+    bool TakeOverflow();
+    
+    DeviceUpdateQueue(const DeviceUpdateQueue&) = delete;
+    DeviceUpdateQueue& operator=(const DeviceUpdateQueue&) = delete;
+    
+private:
+    
+    static const size_t CAPACITY = 256;
+    
+    std::array<DeviceController::Command, CAPACITY> _items;
+    std::atomic<size_t> _head;      // next item to pop
+    std::atomic<size_t> _tail;      // next item to push
+    std::atomic<bool> _isSignalled;
+    std::atomic<bool> _isOverflowed;
+    int _signalSocket;
+};
+
+#endif // DEVICEUPDATEQUEUE_H
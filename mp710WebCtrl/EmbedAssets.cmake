@@ -0,0 +1,77 @@
+# Generates OUTPUT (C++ source) with the web UI files from ASSETS_DIR for EmbeddedAssets.h.
+# Text files are gzipped if GZIP is set. A file is skipped if its minified
+# "name.min.ext" copy exists, and so are the sources of images in image.src.
+# Usage: cmake -DASSETS_DIR=<dir> -DOUTPUT=<file> [-DGZIP=<gzip executable>] -P EmbedAssets.cmake
+
+get_filename_component(OUTPUT_DIR ${OUTPUT} PATH)
+set(GZIP_DIR ${OUTPUT_DIR}/EmbeddedAssets.gz)
+file(MAKE_DIRECTORY ${GZIP_DIR})
+
+file(GLOB_RECURSE ASSETS RELATIVE ${ASSETS_DIR}
+     ${ASSETS_DIR}/*.html ${ASSETS_DIR}/*.js ${ASSETS_DIR}/*.css ${ASSETS_DIR}/*.json
+     ${ASSETS_DIR}/*.png ${ASSETS_DIR}/*.ico ${ASSETS_DIR}/*.svg)
+list(SORT ASSETS)
+
+# Turns the content of FILE_PATH into "0x..,0x..," lines in VAR.
+function(read_as_array FILE_PATH VAR)
+    file(READ ${FILE_PATH} HEX_CONTENT HEX)
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," ARRAY_CONTENT "${HEX_CONTENT}")
+    string(REGEX REPLACE "((0x..,){32})" "\\1\n    " ARRAY_CONTENT "${ARRAY_CONTENT}")
+    set(${VAR} "${ARRAY_CONTENT}" PARENT_SCOPE)
+endfunction()
+
+set(DATA_CONTENT "")
+set(TABLE_CONTENT "")
+set(ASSET_INDEX 0)
+
+foreach(ASSET ${ASSETS})
+    get_filename_component(ASSET_EXT ${ASSET} EXT)
+    string(REGEX REPLACE "^.*(\\.[^.]+)$" "\\1" ASSET_LAST_EXT ${ASSET_EXT})
+    string(REGEX REPLACE "\\.[^.]+$" "" ASSET_BASE ${ASSET})
+    
+    set(ASSET_PATH ${ASSETS_DIR}/${ASSET})
+    file(READ ${ASSET_PATH} ASSET_HEAD LIMIT 1 HEX)
+    
+    if(ASSET MATCHES "^image\\.src/" OR EXISTS ${ASSETS_DIR}/${ASSET_BASE}.min${ASSET_LAST_EXT} OR ASSET_HEAD STREQUAL "")
+        message(STATUS "Not embedding ${ASSET}")
+    else()
+        read_as_array(${ASSET_PATH} DATA_ARRAY)
+        file(MD5 ${ASSET_PATH} ASSET_MD5)
+        string(SUBSTRING ${ASSET_MD5} 0 16 ASSET_ETAG)
+        
+        set(DATA_CONTENT "${DATA_CONTENT}const uint8_t DATA_${ASSET_INDEX}[] = {\n    ${DATA_ARRAY}\n};\n\n")
+        
+        # Images are compressed already.
+        set(GZIP_ENTRY "nullptr, 0")
+        if(GZIP AND NOT ASSET_LAST_EXT STREQUAL ".png")
+            set(GZIP_PATH ${GZIP_DIR}/${ASSET_INDEX}.gz)
+            execute_process(COMMAND ${GZIP} -9 -n -c ${ASSET_PATH} OUTPUT_FILE ${GZIP_PATH})
+            read_as_array(${GZIP_PATH} GZIP_ARRAY)
+            set(DATA_CONTENT "${DATA_CONTENT}const uint8_t GZIP_DATA_${ASSET_INDEX}[] = {\n    ${GZIP_ARRAY}\n};\n\n")
+            set(GZIP_ENTRY "GZIP_DATA_${ASSET_INDEX}, sizeof(GZIP_DATA_${ASSET_INDEX})")
+        endif()
+        
+        set(TABLE_CONTENT "${TABLE_CONTENT}    {\"/${ASSET}\", DATA_${ASSET_INDEX}, sizeof(DATA_${ASSET_INDEX}), ${GZIP_ENTRY}, \"${ASSET_ETAG}\"},\n")
+        
+        math(EXPR ASSET_INDEX "${ASSET_INDEX} + 1")
+    endif()
+endforeach()
+
+file(WRITE ${OUTPUT}.tmp
+"// Generated by EmbedAssets.cmake from ${ASSETS_DIR}, do not edit.
+
+#include \"EmbeddedAssets.h\"
+
+namespace {
+
+${DATA_CONTENT}}
+
+constexpr EmbeddedAsset EMBEDDED_ASSETS[] = {
+${TABLE_CONTENT}};
+
+const size_t EMBEDDED_ASSETS_COUNT = sizeof(EMBEDDED_ASSETS) / sizeof(EMBEDDED_ASSETS[0]);
+")
+
+# Keeps the timestamp when nothing changed, so the source is not rebuilt.
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
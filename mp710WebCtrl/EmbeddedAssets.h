@@ -0,0 +1,42 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef EMBEDDEDASSETS_H
+#define EMBEDDEDASSETS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Web UI file compiled into the binary, see EmbedAssets.cmake.
+struct EmbeddedAsset
+{
+    const char* Uri;
+    const uint8_t* Data;
+    size_t Size;
+    const uint8_t* GzipData;    // nullptr if the file is not compressed
+    size_t GzipSize;
+    const char* ETag;
+};
+
+extern const EmbeddedAsset EMBEDDED_ASSETS[];
+extern const size_t EMBEDDED_ASSETS_COUNT;
+
+#endif // EMBEDDEDASSETS_H
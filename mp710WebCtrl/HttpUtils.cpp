@@ -0,0 +1,84 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "HttpUtils.h"
+
+namespace HttpUtils {
+    
+    namespace {
+        const char* GetReasonPhrase(int statusCode) {
+            switch (statusCode) {
+                case 200:
+                    return "OK";
+                case 202:
+                    return "Accepted";
+                case 304:
+                    return "Not Modified";
+                case 400:
+                    return "Bad Request";
+                case 404:
+                    return "Not Found";
+                case 405:
+                    return "Method Not Allowed";
+                case 413:
+                    return "Payload Too Large";
+                default:
+                    return "Unknown";
+            }
+        }
+    }
+    
+    bool IsKeepAlive(http_message* hm) {
+        const mg_str* connection = mg_get_http_header(hm, "Connection");
+        
+        if (mg_vcmp(&hm->proto, "HTTP/1.1") == 0) {
+            return connection == nullptr || mg_vcasecmp(connection, "close") != 0;
+        }
+        
+        return connection != nullptr && mg_vcasecmp(connection, "keep-alive") == 0;
+    }
+    
+    void SendResponse(mg_connection* nc, http_message* hm, int statusCode, const char* contentType,
+                      const void* body, size_t bodySize, const char* extraHeaders) {
+        const bool keepAlive = IsKeepAlive(hm);
+        
+        // Written here, as mongoose knows reason phrases for few status codes only.
+        mg_printf(nc, "HTTP/1.1 %d %s\r\n", statusCode, GetReasonPhrase(statusCode));
+        if (extraHeaders != nullptr) {
+            mg_printf(nc, "%s\r\n", extraHeaders);
+        }
+        
+        // 304 refers to the cached representation and has no content of its own.
+        if (statusCode != 304) {
+            mg_printf(nc, "Content-Type: %s\r\nContent-Length: %u\r\n", contentType, static_cast<unsigned>(bodySize));
+        }
+        mg_printf(nc, "Connection: %s\r\n\r\n", keepAlive ? "keep-alive" : "close");
+        
+        // HEAD responses carry the headers of GET but no body.
+        if (bodySize > 0 && mg_vcmp(&hm->method, "HEAD") != 0) {
+            mg_send(nc, body, bodySize);
+        }
+        
+        if (!keepAlive) {
+            nc->flags |= MG_F_SEND_AND_CLOSE;
+        }
+    }
+}
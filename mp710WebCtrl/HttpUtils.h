@@ -0,0 +1,40 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef HTTPUTILS_H
+#define HTTPUTILS_H
+
+#include <cstddef>
+
+#include "../thirdparty/mongoose/mongoose.h"
+
+namespace HttpUtils {
+    
+    // HTTP/1.1 keeps the connection unless asked to close, HTTP/1.0 only if asked to keep.
+    bool IsKeepAlive(http_message* hm);
+    
+    // Sends a complete response and closes the connection afterwards unless it is kept alive.
+    // extraHeaders are "\r\n"-separated without the trailing one, may be nullptr.
+    void SendResponse(mg_connection* nc, http_message* hm, int statusCode, const char* contentType,
+                      const void* body, size_t bodySize, const char* extraHeaders = nullptr);
+}
+
+#endif // HTTPUTILS_H
@@ -0,0 +1,115 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "JsonSerializer.h"
+
+#include <cstring>
+
+namespace JsonSerializer {
+    
+    namespace {
+        // Appends to [pos, end) and turns pos to nullptr once it does not fit.
+        template<size_t N>
+        void Append(char*& pos, const char* end, const char (&text)[N]) {
+            const size_t size = N - 1;
+            if (pos == nullptr || static_cast<size_t>(end - pos) < size) {
+                pos = nullptr;
+                return;
+            }
+            memcpy(pos, text, size);
+            pos += size;
+        }
+        
+        void AppendString(char*& pos, const char* end, const char* text) {
+            const size_t size = strlen(text);
+            if (pos == nullptr || static_cast<size_t>(end - pos) < size) {
+                pos = nullptr;
+                return;
+            }
+            memcpy(pos, text, size);
+            pos += size;
+        }
+        
+        void Append(char*& pos, const char* end, unsigned value) {
+            char digits[10];
+            size_t count = 0;
+            do {
+                digits[count++] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            } while (value != 0);
+            
+            if (pos == nullptr || static_cast<size_t>(end - pos) < count) {
+                pos = nullptr;
+                return;
+            }
+            while (count != 0) {
+                *pos++ = digits[--count];
+            }
+        }
+    }
+    
+    size_t Serialize(const DeviceController::Command* commands, size_t count, char* buffer, size_t bufferSize) {
+        char* pos = buffer;
+        const char* end = buffer + bufferSize;
+        
+        if (0 == count) {
+            Append(pos, end, "{}");
+        }
+        
+        for (size_t i = 0; i < count; ++i) {
+            const DeviceController::Command& command = commands[i];
+            
+            if (0 == i) {
+                Append(pos, end, "{ ");
+            }
+            Append(pos, end, "\"");
+            Append(pos, end, command.ChannelIdx);
+            Append(pos, end, "\": { \"type\":");
+            Append(pos, end, static_cast<unsigned>(command.Type));
+            Append(pos, end, ", \"channelIdx\":");
+            Append(pos, end, command.ChannelIdx);
+            Append(pos, end, ", \"param\":");
+            Append(pos, end, command.Param);
+            Append(pos, end, "}");
+            if (i + 1 != count) {
+                Append(pos, end, ", ");
+            }
+            else {
+                Append(pos, end, "} ");
+            }
+        }
+        
+        return (pos != nullptr) ? static_cast<size_t>(pos - buffer) : 0;
+    }
+    
+    size_t SerializeError(const char* message, size_t offset, char* buffer, size_t bufferSize) {
+        char* pos = buffer;
+        const char* end = buffer + bufferSize;
+        
+        Append(pos, end, "{ \"error\": \"");
+        AppendString(pos, end, message);
+        Append(pos, end, "\", \"offset\": ");
+        Append(pos, end, static_cast<unsigned>(offset));
+        Append(pos, end, " }");
+        
+        return (pos != nullptr) ? static_cast<size_t>(pos - buffer) : 0;
+    }
+}
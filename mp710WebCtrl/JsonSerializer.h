@@ -0,0 +1,56 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef JSONSERIALIZER_H
+#define JSONSERIALIZER_H
+
+#include <cstddef>
+
+#include "../mp710Lib/DeviceController.h"
+
+// Formats channel states as { "idx": { "type":T, "channelIdx":C, "param":P}, ... }
+// into a caller-provided buffer without heap allocations.
+namespace JsonSerializer {
+    
+    constexpr size_t Digits(unsigned value) {
+        return value < 10 ? 1 : 1 + Digits(value / 10);
+    }
+    
+    // Text around the values of one entry: "{ " (first only), "\"", "\": { \"type\":",
+    // ", \"channelIdx\":", ", \"param\":", "}", ", " or "} ".
+    static constexpr size_t ENTRY_TEXT_SIZE = 2 + 1 + 12 + 15 + 10 + 1 + 2;
+    
+    static constexpr size_t ENTRY_SIZE_MAX = ENTRY_TEXT_SIZE +
+        2 * Digits(DeviceController::CHANNELS_NUMBER - 1) +  // key and channelIdx
+        Digits(DeviceController::NOT_SET) +                  // type
+        Digits(DeviceController::BRIGHTNESS_MAX);            // param
+    
+    // Enough for the state of all channels.
+    static constexpr size_t STATE_SIZE_MAX = ENTRY_SIZE_MAX * DeviceController::CHANNELS_NUMBER;
+    
+    // Returns the text size, 0 if buffer is too small.
+    size_t Serialize(const DeviceController::Command* commands, size_t count, char* buffer, size_t bufferSize);
+    
+    // Formats { "error": "message", "offset": N }. Message must not need escaping.
+    size_t SerializeError(const char* message, size_t offset, char* buffer, size_t bufferSize);
+}
+
+#endif // JSONSERIALIZER_H
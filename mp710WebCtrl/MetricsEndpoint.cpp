@@ -0,0 +1,56 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "MetricsEndpoint.h"
+
+#include <string>
+
+#include "HttpUtils.h"
+#include "../metrics/Metrics.h"
+
+namespace MetricsEndpoint {
+    
+    namespace {
+        
+        const char METRICS_URI[] = "/metrics";
+        
+        // Reused between scrapes, only used from the event loop thread.
+        std::string output;
+    }
+    
+    bool HandleRequest(mg_connection* nc, http_message* hm) {
+        if (mg_vcmp(&hm->uri, METRICS_URI) != 0) {
+            return false;
+        }
+        
+        if (mg_vcmp(&hm->method, "GET") != 0 && mg_vcmp(&hm->method, "HEAD") != 0) {
+            HttpUtils::SendResponse(nc, hm, 405, "text/plain", "Method not allowed\n", 19, "Allow: GET, HEAD");
+            return true;
+        }
+        
+        output.clear();
+        Metrics::WriteAll(output);
+        
+        HttpUtils::SendResponse(nc, hm, 200, Metrics::CONTENT_TYPE, output.data(), output.size(), "Cache-Control: no-cache");
+        
+        return true;
+    }
+}
@@ -0,0 +1,288 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "RestApi.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "CommandParser.h"
+#include "HttpUtils.h"
+#include "JsonSerializer.h"
+
+namespace RestApi {
+    
+    namespace {
+        
+        const char API_PREFIX[] = "/api/";
+        const char CHANNELS_URI[] = "/api/channels";
+        const char JSON_CONTENT_TYPE[] = "application/json";
+        
+        // An object with 5 fields and its key in a container take at most 12 tokens.
+        const size_t TOKENS_MAX = 2 + 12 * CommandParser::MAX_COMMANDS + 1;
+        
+        // Only used from the event loop thread.
+        json_token tokens[TOKENS_MAX];
+        
+        void SendError(mg_connection* nc, http_message* hm, int statusCode, const char* message, size_t offset, const char* extraHeaders = nullptr) {
+            char body[128];
+            const size_t size = JsonSerializer::SerializeError(message, offset, body, sizeof(body));
+            HttpUtils::SendResponse(nc, hm, statusCode, JSON_CONTENT_TYPE, body, size, extraHeaders);
+        }
+        
+        // channelIdx equal to CHANNELS_NUMBER selects all channels.
+        void SendState(mg_connection* nc, http_message* hm, int statusCode, DeviceController& deviceController, unsigned channelIdx) {
+            DeviceController::Snapshot snapshot;
+            deviceController.GetSnapshot(snapshot);
+            
+            char body[JsonSerializer::STATE_SIZE_MAX];
+            size_t size = 0;
+            
+            if (channelIdx < DeviceController::CHANNELS_NUMBER) {
+                size = JsonSerializer::Serialize(&snapshot.Commands[channelIdx], 1, body, sizeof(body));
+            }
+            else {
+                size = JsonSerializer::Serialize(snapshot.Commands.data(), snapshot.Commands.size(), body, sizeof(body));
+            }
+            
+            HttpUtils::SendResponse(nc, hm, statusCode, JSON_CONTENT_TYPE, body, size);
+        }
+        
+        bool ParseUnsigned(const char* text, size_t size, uint32_t& value) {
+            if (0 == size || size > 10) {
+                return false;
+            }
+            
+            uint64_t result = 0;
+            for (size_t i = 0; i < size; ++i) {
+                if (text[i] < '0' || text[i] > '9') {
+                    return false;
+                }
+                result = result * 10 + (text[i] - '0');
+            }
+            
+            if (result > UINT32_MAX) {
+                return false;
+            }
+            
+            value = static_cast<uint32_t>(result);
+            return true;
+        }
+        
+        bool TokenEquals(const json_token& token, const char* text) {
+            return static_cast<size_t>(token.len) == strlen(text) && memcmp(token.ptr, text, token.len) == 0;
+        }
+        
+        // Reads a command object. channelIdx other than CHANNELS_NUMBER is implied by the URI or key.
+        const char* ReadCommand(const json_token* object, unsigned channelIdx, DeviceController::Command& command) {
+            if (object->type != JSON_TYPE_OBJECT) {
+                return "object expected";
+            }
+            
+            uint32_t type = DeviceController::NOT_SET;
+            uint32_t bodyChannelIdx = DeviceController::CHANNELS_NUMBER;
+            uint32_t param = 0;
+            uint32_t duration = 0;
+            uint32_t easing = DeviceController::EASE_LINEAR;
+            bool hasParam = false;
+            
+            for (int i = 1; i <= object->num_desc; i += 2 + object[i + 1].num_desc) {
+                const json_token& key = object[i];
+                const json_token& value = object[i + 1];
+                
+                uint32_t number = 0;
+                if (value.type != JSON_TYPE_NUMBER || !ParseUnsigned(value.ptr, value.len, number)) {
+                    return "non-negative integer expected";
+                }
+                
+                if (TokenEquals(key, "param")) {
+                    param = number;
+                    hasParam = true;
+                }
+                else if (TokenEquals(key, "type")) {
+                    type = number;
+                }
+                else if (TokenEquals(key, "channelIdx")) {
+                    bodyChannelIdx = number;
+                }
+                else if (TokenEquals(key, "duration")) {
+                    duration = number;
+                }
+                else if (TokenEquals(key, "easing")) {
+                    easing = number;
+                }
+                else {
+                    return "unknown field";
+                }
+            }
+            
+            if (!hasParam) {
+                return "param is missing";
+            }
+            
+            if (channelIdx == DeviceController::CHANNELS_NUMBER) {
+                channelIdx = bodyChannelIdx;
+            }
+            else if (bodyChannelIdx != DeviceController::CHANNELS_NUMBER && bodyChannelIdx != channelIdx) {
+                return "channelIdx does not match";
+            }
+            
+            if (type == DeviceController::NOT_SET) {
+                type = (duration > 0) ? DeviceController::FADE : DeviceController::SET_BRIGHTNESS;
+            }
+            
+            if (type > DeviceController::FADE || easing > DeviceController::EASE_IN_OUT) {
+                return type > DeviceController::FADE ? "unknown command type" : "unknown easing";
+            }
+            
+            command = DeviceController::Command(static_cast<DeviceController::CommandTypesEnum>(type),
+                                                channelIdx,
+                                                param,
+                                                duration,
+                                                static_cast<DeviceController::EasingEnum>(easing));
+            
+            return CommandParser::Validate(command);
+        }
+        
+        // Parses the body of a request, shape depends on the resource (see RestApi.h).
+        bool ReadCommands(mg_connection* nc, http_message* hm, bool isBatch, unsigned channelIdx,
+                          DeviceController::Command* commands, size_t& count) {
+            count = 0;
+            
+            const int parseResult = parse_json(hm->body.p, static_cast<int>(hm->body.len), tokens, TOKENS_MAX);
+            if (JSON_TOKEN_ARRAY_TOO_SMALL == parseResult) {
+                SendError(nc, hm, 413, "too many commands", 0);
+                return false;
+            }
+            if (parseResult < 0) {
+                SendError(nc, hm, 400, "malformed JSON", 0);
+                return false;
+            }
+            
+            const json_token* root = &tokens[0];
+            const char* error = nullptr;
+            const json_token* errorToken = root;
+            
+            if (channelIdx < DeviceController::CHANNELS_NUMBER) {
+                // Single channel, the object is the command.
+                error = ReadCommand(root, channelIdx, commands[0]);
+                count = (nullptr == error) ? 1 : 0;
+            }
+            else if (isBatch) {
+                const json_token* list = find_json_token(tokens, "commands");
+                if (nullptr == list || list->type != JSON_TYPE_ARRAY) {
+                    error = "commands array expected";
+                }
+                
+                for (int i = 1; nullptr == error && nullptr != list && i <= list->num_desc; i += 1 + list[i].num_desc) {
+                    errorToken = &list[i];
+                    if (count == CommandParser::MAX_COMMANDS) {
+                        error = "too many commands";
+                        break;
+                    }
+                    error = ReadCommand(&list[i], DeviceController::CHANNELS_NUMBER, commands[count++]);
+                }
+            }
+            else {
+                // Object keyed by channel index.
+                for (int i = 1; nullptr == error && i <= root->num_desc; i += 2 + root[i + 1].num_desc) {
+                    errorToken = &root[i];
+                    
+                    uint32_t keyIdx = 0;
+                    if (!ParseUnsigned(root[i].ptr, root[i].len, keyIdx) || keyIdx >= DeviceController::CHANNELS_NUMBER) {
+                        error = "channel index is out of range";
+                        break;
+                    }
+                    if (count == CommandParser::MAX_COMMANDS) {
+                        error = "too many commands";
+                        break;
+                    }
+                    error = ReadCommand(&root[i + 1], keyIdx, commands[count++]);
+                }
+            }
+            
+            if (error != nullptr) {
+                count = 0;
+                SendError(nc, hm, 400, error, errorToken->ptr - hm->body.p);
+                return false;
+            }
+            
+            return true;
+        }
+        
+        void HandleChannels(mg_connection* nc, http_message* hm, DeviceController& deviceController, unsigned channelIdx) {
+            const bool isAll = (channelIdx == DeviceController::CHANNELS_NUMBER);
+            
+            if (mg_vcmp(&hm->method, "GET") == 0 || mg_vcmp(&hm->method, "HEAD") == 0) {
+                SendState(nc, hm, 200, deviceController, channelIdx);
+                return;
+            }
+            
+            const bool isPut = (mg_vcmp(&hm->method, "PUT") == 0);
+            const bool isPost = isAll && (mg_vcmp(&hm->method, "POST") == 0);
+            
+            if (!isPut && !isPost) {
+                SendError(nc, hm, 405, "method is not allowed", 0,
+                          isAll ? "Allow: GET, HEAD, PUT, POST" : "Allow: GET, HEAD, PUT");
+                return;
+            }
+            
+            DeviceController::Command commands[CommandParser::MAX_COMMANDS];
+            size_t count = 0;
+            
+            if (ReadCommands(nc, hm, isPost, channelIdx, commands, count)) {
+                deviceController.AddCommands(commands, count);
+                SendState(nc, hm, 202, deviceController, channelIdx);
+            }
+        }
+    }
+    
+    bool HandleRequest(mg_connection* nc, http_message* hm, DeviceController& deviceController) {
+        const size_t prefixSize = sizeof(API_PREFIX) - 1;
+        if (hm->uri.len < prefixSize || memcmp(hm->uri.p, API_PREFIX, prefixSize) != 0) {
+            return false;
+        }
+        
+        const size_t channelsSize = sizeof(CHANNELS_URI) - 1;
+        
+        if (mg_vcmp(&hm->uri, CHANNELS_URI) == 0) {
+            HandleChannels(nc, hm, deviceController, DeviceController::CHANNELS_NUMBER);
+        }
+        else if (hm->uri.len > channelsSize + 1 &&
+                 memcmp(hm->uri.p, CHANNELS_URI, channelsSize) == 0 &&
+                 hm->uri.p[channelsSize] == '/') {
+            uint32_t channelIdx = 0;
+            
+            if (ParseUnsigned(hm->uri.p + channelsSize + 1, hm->uri.len - channelsSize - 1, channelIdx) &&
+                channelIdx < DeviceController::CHANNELS_NUMBER) {
+                HandleChannels(nc, hm, deviceController, channelIdx);
+            }
+            else {
+                SendError(nc, hm, 404, "no such channel", 0);
+            }
+        }
+        else {
+            SendError(nc, hm, 404, "no such resource", 0);
+        }
+        
+        return true;
+    }
+}
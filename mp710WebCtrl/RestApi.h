@@ -0,0 +1,42 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef RESTAPI_H
+#define RESTAPI_H
+
+#include "../thirdparty/mongoose/mongoose.h"
+#include "../mp710Lib/DeviceController.h"
+
+// JSON HTTP interface to the channels:
+//   GET  /api/channels        - state of all channels
+//   PUT  /api/channels        - { "idx": { "param":P[, "type":T, "duration":D, "easing":E] }, ... }
+//   POST /api/channels        - { "commands": [ { "channelIdx":C, "param":P, ... }, ... ] }
+//   GET  /api/channels/{idx}  - state of one channel
+//   PUT  /api/channels/{idx}  - { "param":P[, "type":T, "duration":D, "easing":E] }
+// Type defaults to FADE if duration is given, to SET_BRIGHTNESS otherwise.
+// Changes are executed asynchronously, so they reply 202 with the state known at that moment.
+namespace RestApi {
+    
+    // Returns false if the URI does not belong to the API.
+    bool HandleRequest(mg_connection* nc, http_message* hm, DeviceController& deviceController);
+}
+
+#endif // RESTAPI_H
@@ -22,25 +22,91 @@
 #include <cstdlib>
 #include <cstdint>
 #include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <atomic>
-#include <vector>
 #include <cstdio>
+#include <cstring>
 #include <functional>
+#include <tuple>
+#include <vector>
 
 #include "../thirdparty/mongoose/mongoose.h"
 
 #include "../tracer/Tracer.h"
+#include "../metrics/Metrics.h"
 #include "../mp710Lib/DeviceController.h"
+#include "../mp710Lib/SimulatedBackend.h"
+#include "../mp710Lib/UsbBackend.h"
+
+#include "DeviceUpdateQueue.h"
+#include "BroadcastAggregator.h"
+#include "BinaryProtocol.h"
+#include "JsonSerializer.h"
+#include "CommandParser.h"
+#include "RestApi.h"
+#include "MetricsEndpoint.h"
+#include "AssetCache.h"
+#include "HttpUtils.h"
 
 namespace {
+    struct Options
+    {
+        std::vector<const char*> ListenAddresses;
+        const char* WorkDir;
+        const char* TraceFile;
+        unsigned BroadcastWindowMs;
+        bool Simulate;
+        unsigned SimulateLatencyUs;
+        double SimulateFailureRate;
+        
+        Options()
+            : WorkDir(nullptr), TraceFile(nullptr), BroadcastWindowMs(BroadcastAggregator::DEFAULT_WINDOW_MS), Simulate(false),
+            SimulateLatencyUs(SimulatedBackend::DEFAULT_LATENCY_US), SimulateFailureRate(0.0)
+        { }
+    };
+    
+    void PrintUsage(const char* name);
+    bool ParseOptions(int argc, char** argv, Options& options);
+    mg_connection* Listen(mg_mgr* mgr, const char* address);
     void SignalsHandler(int signal);
     bool IsSignalRaised(void);
-    void Broadcast(mg_connection* nc, const char* msg, size_t size);
+    char* PrependWebSocketHeader(int op, char* payload, size_t size);
+    bool IsSubprotocolOffered(const mg_str* offered, const char* name);
+    void SendWebSocketHandshake(mg_connection* nc, http_message* hm, const char* protocol);
+    void Broadcast(mg_mgr* mgr, const DeviceController::Command* commands, size_t count);
     void EventHandler(mg_connection* nc, int event, void* eventData);
-    void SendUpdate(struct mg_connection* nc, const std::vector<DeviceController::Command>& commands);
-    void OnDeviceUpdate(struct mg_connection* netConnection, bool result, DeviceController::CommandTypesEnum type, unsigned channelIdx, unsigned param);
+    void UpdatesHandler(mg_connection* nc, int event, void* eventData);
+    void FlushUpdates(mg_mgr* mgr);
+    void SendUpdate(struct mg_connection* nc, const DeviceController::Command* commands, size_t count, BinaryProtocol::FrameKindEnum kind);
+    void OnDeviceUpdate(DeviceUpdateQueue* updates, bool result, DeviceController::CommandTypesEnum type, unsigned channelIdx, unsigned param);
+    
+    // Set on websocket connections that negotiated BinaryProtocol.
+    const unsigned long MG_F_BINARY_PROTOCOL = MG_F_USER_1;
+    // Set on websocket connections counted in WebSocketClients.
+    const unsigned long MG_F_COUNTED_CLIENT = MG_F_USER_2;
+    
+    // Room reserved in front of a payload for the websocket frame header.
+    const size_t WEBSOCKET_HEADER_SIZE_MAX = 10;
+    
+    const char DEFAULT_LISTEN_ADDRESS[] = "8000";
+    const char UNIX_SOCKET_PREFIX[] = "unix:";
     
     mg_serve_http_opts serveHttpOpts = {.document_root = "."};
+    bool isWorkDirSet = false;
+    AssetCache assetCache;
+    
+    Metrics::Counter HttpRequests("mp710_http_requests_total", "HTTP requests received.");
+    Metrics::Gauge WebSocketClients("mp710_websocket_clients", "Connected websocket clients.");
+    Metrics::Counter WebSocketFrames("mp710_websocket_frames_received_total", "Websocket frames received from clients.");
+    Metrics::Counter BroadcastFrames("mp710_broadcast_frames_total", "State update frames queued to websocket clients.");
+    Metrics::Counter BroadcastBytes("mp710_broadcast_bytes_total", "Bytes of state update frames queued to websocket clients.");
+    Metrics::Counter UpdateQueueOverflows("mp710_update_queue_overflows_total", "Device update queue overflows, each resends the full state.");
+    DeviceUpdateQueue deviceUpdates;
+    BroadcastAggregator broadcastAggregator;
 }
 
 int main(int argc, char **argv) {
@@ -48,46 +114,257 @@ int main(int argc, char **argv) {
   signal(SIGTERM, SignalsHandler);
   signal(SIGINT, SignalsHandler);
   
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  
+  if (options.TraceFile != nullptr && !Tracer::SetTraceFile(options.TraceFile)) {
+    return 1;
+  }
+  
+  Tracer::StartAsync();
+  
   mg_mgr mgr;
   mg_mgr_init(&mgr, nullptr);
   
-  static const char* HTTP_PORT = "8000";
+  std::vector<mg_connection*> listeners;
+  for (const char* address : options.ListenAddresses) {
+    mg_connection* listener = Listen(&mgr, address);
+    if (nullptr == listener) {
+      TRACER_ERROR(Tracer::CATEGORY_WEB, "Failed to listen on %s.\n", address);
+      mg_mgr_free(&mgr);
+      return 1;
+    }
+    listeners.push_back(listener);
+  }
   
-  mg_connection* netConnection = mg_bind(&mgr, HTTP_PORT, EventHandler);
-  if (nullptr == netConnection) {
-    Tracer::Log("Failed to initialize HTTP server.\n");
-    return 1;
+  // The web UI compiled into the binary is used unless --workDir points to another one.
+  if (options.WorkDir != nullptr) {
+    serveHttpOpts.document_root = options.WorkDir;
+    isWorkDirSet = true;
+    assetCache.Load(serveHttpOpts.document_root);
+  }
+  else {
+    assetCache.LoadEmbedded();
   }
   
-  if (argc > 2 && strcmp(argv[1], "--workDir") == 0) {
-    serveHttpOpts.document_root = argv[2];
+  broadcastAggregator.SetWindow(options.BroadcastWindowMs);
+  
+  DeviceController::DoneCallback doneCallback = std::bind(&OnDeviceUpdate, &deviceUpdates, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
+  
+  std::unique_ptr<DeviceBackend> backend;
+  if (options.Simulate) {
+    backend.reset(new SimulatedBackend(DeviceController::DEFAULT_TRANSFERS_IN_FLIGHT,
+                                       std::chrono::microseconds(options.SimulateLatencyUs),
+                                       options.SimulateFailureRate));
+  }
+  else {
+    backend.reset(new UsbBackend());
   }
   
-  static const size_t MAX_QUEUE_SIZE = 100;
-  DeviceController::DoneCallback doneCallback = std::bind(&OnDeviceUpdate, netConnection, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
+  DeviceController deviceController(doneCallback, std::move(backend));
   
-  DeviceController deviceController(MAX_QUEUE_SIZE, doneCallback);
+  // Completions arrive on the device worker thread and are broadcast from here.
+  if (!deviceUpdates.Attach(&mgr, UpdatesHandler, &deviceController)) {
+    mg_mgr_free(&mgr);
+    return 1;
+  }
   
-  netConnection->user_data = &deviceController;
-  mg_set_protocol_http_websocket(netConnection);
+  for (mg_connection* listener : listeners) {
+    listener->user_data = &deviceController;
+    mg_set_protocol_http_websocket(listener);
+  }
   
   while (!IsSignalRaised()) {
-      mg_mgr_poll(&mgr, 200);
+      mg_mgr_poll(&mgr, broadcastAggregator.GetTimeoutMs(200));
+      
+      if (broadcastAggregator.IsDue()) {
+          FlushUpdates(&mgr);
+      }
   }
   
-  Tracer::Log("Stopping...\n");
+  TRACER_INFO(Tracer::CATEGORY_WEB, "Stopping...\n");
 
   mg_mgr_free(&mgr);
   
+  for (const char* address : options.ListenAddresses) {
+    if (strncmp(address, UNIX_SOCKET_PREFIX, strlen(UNIX_SOCKET_PREFIX)) == 0) {
+      unlink(address + strlen(UNIX_SOCKET_PREFIX));
+    }
+  }
+  
+  Tracer::StopAsync();
+  
   return 0;
 }
 
 namespace {
     
+    void PrintUsage(const char* name) {
+        fprintf(stderr,
+                "Usage: %s [options]\n"
+                "  -l, --listen ADDRESS         Accept HTTP connections on ADDRESS, may be repeated:\n"
+                "                               PORT, IP:PORT, [IPv6]:PORT or unix:PATH (default: 8000)\n"
+                "  -p, --port PORT              Same as --listen PORT\n"
+                "  -d, --workDir DIR            Serve the web UI from DIR instead of the built-in one\n"
+                "  -w, --broadcastWindow MS     Gather channel changes for MS ms into one frame (default: %u)\n"
+                "  -s, --simulate               Use an in-process MP710 model, e.g. for load testing\n"
+                "      --simulate-latency-us US Time the model takes per transfer (default: %u)\n"
+                "      --simulate-failure-rate R\n"
+                "                               Share of model transfers that fail, 0 to 1 (default: 0)\n"
+                "  -v, --logLevel LEVELS        trace, debug, info, warn, error or none, optionally\n"
+                "                               per category: info,usb=trace (categories: general,\n"
+                "                               device, usb, web; default: info)\n"
+                "  -t, --traceFile FILE         Write trace events to FILE, see mp710TraceDecode\n"
+                "  -h, --help                   Show this help\n",
+                name,
+                BroadcastAggregator::DEFAULT_WINDOW_MS,
+                SimulatedBackend::DEFAULT_LATENCY_US);
+    }
+    
+    bool ParseOptions(int argc, char** argv, Options& options) {
+        // Long only options have values outside of the char range.
+        enum {OPTION_SIMULATE_LATENCY_US = 0x100, OPTION_SIMULATE_FAILURE_RATE};
+        
+        static const option LONG_OPTIONS[] = {
+            {"listen", required_argument, nullptr, 'l'},
+            {"port", required_argument, nullptr, 'p'},
+            {"workDir", required_argument, nullptr, 'd'},
+            {"broadcastWindow", required_argument, nullptr, 'w'},
+            {"simulate", no_argument, nullptr, 's'},
+            {"simulate-latency-us", required_argument, nullptr, OPTION_SIMULATE_LATENCY_US},
+            {"simulate-failure-rate", required_argument, nullptr, OPTION_SIMULATE_FAILURE_RATE},
+            {"logLevel", required_argument, nullptr, 'v'},
+            {"traceFile", required_argument, nullptr, 't'},
+            {"help", no_argument, nullptr, 'h'},
+            {nullptr, 0, nullptr, 0}
+        };
+        
+        int optionChar;
+        while ((optionChar = getopt_long(argc, argv, "l:p:d:w:sv:t:h", LONG_OPTIONS, nullptr)) != -1) {
+            switch (optionChar) {
+                case 'l':
+                case 'p':
+                    options.ListenAddresses.push_back(optarg);
+                    break;
+                case 'd':
+                    options.WorkDir = optarg;
+                    break;
+                case 'w': {
+                    char* end = nullptr;
+                    options.BroadcastWindowMs = strtoul(optarg, &end, 10);
+                    if (end == optarg || *end != '\0') {
+                        return false;
+                    }
+                    break;
+                }
+                case 's':
+                    options.Simulate = true;
+                    break;
+                case OPTION_SIMULATE_LATENCY_US: {
+                    char* end = nullptr;
+                    options.SimulateLatencyUs = strtoul(optarg, &end, 10);
+                    if (end == optarg || *end != '\0') {
+                        return false;
+                    }
+                    break;
+                }
+                case OPTION_SIMULATE_FAILURE_RATE: {
+                    char* end = nullptr;
+                    options.SimulateFailureRate = strtod(optarg, &end);
+                    if (end == optarg || *end != '\0' ||
+                        !(options.SimulateFailureRate >= 0.0 && options.SimulateFailureRate <= 1.0)) {
+                        return false;
+                    }
+                    break;
+                }
+                case 't':
+                    options.TraceFile = optarg;
+                    break;
+                case 'v':
+                    if (!Tracer::SetLevels(optarg)) {
+                        return false;
+                    }
+                    break;
+                case 'h':
+                    PrintUsage(argv[0]);
+                    exit(0);
+                default:
+                    return false;
+            }
+        }
+        
+        if (optind != argc) {
+            return false;
+        }
+        
+        if (options.ListenAddresses.empty()) {
+            options.ListenAddresses.push_back(DEFAULT_LISTEN_ADDRESS);
+        }
+        
+        return true;
+    }
+    
+    mg_connection* Listen(mg_mgr* mgr, const char* address) {
+        const size_t prefixSize = strlen(UNIX_SOCKET_PREFIX);
+        if (strncmp(address, UNIX_SOCKET_PREFIX, prefixSize) != 0) {
+            return mg_bind(mgr, address, EventHandler);
+        }
+        
+        // Mongoose binds TCP and UDP only, local clients are accepted by it from a ready socket.
+        const char* path = address + prefixSize;
+        
+        sockaddr_un socketAddress;
+        memset(&socketAddress, 0, sizeof(socketAddress));
+        socketAddress.sun_family = AF_UNIX;
+        if (strlen(path) == 0 || strlen(path) >= sizeof(socketAddress.sun_path)) {
+            TRACER_ERROR(Tracer::CATEGORY_WEB, "Invalid unix socket path %s.\n", path);
+            return nullptr;
+        }
+        strcpy(socketAddress.sun_path, path);
+        
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            TRACER_ERRNO(Tracer::CATEGORY_WEB, "Failed to create unix socket.\n");
+            return nullptr;
+        }
+        
+        // A socket file left by a previous run would make bind fail. Any other
+        // file is kept, the path is more likely mistyped than stale.
+        struct stat pathStat;
+        if (lstat(path, &pathStat) == 0) {
+            if (!S_ISSOCK(pathStat.st_mode)) {
+                TRACER_ERROR(Tracer::CATEGORY_WEB, "%s exists and is not a socket.\n", path);
+                close(fd);
+                return nullptr;
+            }
+            unlink(path);
+        }
+        
+        if (bind(fd, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0 ||
+            listen(fd, SOMAXCONN) != 0) {
+            TRACER_ERRNO(Tracer::CATEGORY_WEB, "Failed to listen on unix socket %s.\n", path);
+            close(fd);
+            return nullptr;
+        }
+        
+        mg_connection* listener = mg_add_sock(mgr, fd, EventHandler);
+        if (nullptr == listener) {
+            close(fd);
+            return nullptr;
+        }
+        listener->flags |= MG_F_LISTENING;
+        
+        return listener;
+    }
+    
+    
     std::atomic<bool> NeedToStopPolling(false);
     
     void SignalsHandler(int signal) {
-        Tracer::Log("Interrupted by signal %i.\n", signal);
+        TRACER_INFO(Tracer::CATEGORY_WEB, "Interrupted by signal %i.\n", signal);
         NeedToStopPolling = true;
     }
     
@@ -95,9 +372,130 @@ namespace {
         return NeedToStopPolling;
     }
     
-    void Broadcast(mg_connection* nc, const char* msg, size_t size) {
-        for (mg_connection *c = mg_next(nc->mgr, nullptr); c != nullptr; c = mg_next(nc->mgr, c)) {
-            mg_send_websocket_frame(c, WEBSOCKET_OP_TEXT, msg, size);
+    bool IsSubprotocolOffered(const mg_str* offered, const char* name) {
+        if (nullptr == offered) {
+            return false;
+        }
+        
+        // A comma separated list of tokens (RFC 6455, 11.3.4).
+        const size_t nameLength = strlen(name);
+        const char* end = offered->p + offered->len;
+        const char* token = offered->p;
+        
+        while (token < end) {
+            while (token < end && (*token == ' ' || *token == '\t' || *token == ',')) {
+                ++token;
+            }
+            
+            const char* tokenEnd = token;
+            while (tokenEnd < end && *tokenEnd != ',' && *tokenEnd != ' ' && *tokenEnd != '\t') {
+                ++tokenEnd;
+            }
+            
+            if (static_cast<size_t>(tokenEnd - token) == nameLength && memcmp(token, name, nameLength) == 0) {
+                return true;
+            }
+            
+            token = tokenEnd;
+        }
+        
+        return false;
+    }
+    
+    void SendWebSocketHandshake(mg_connection* nc, http_message* hm, const char* protocol) {
+        static const char GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        
+        const mg_str* key = mg_get_http_header(hm, "Sec-WebSocket-Key");
+        if (nullptr == key) {
+            return;
+        }
+        
+        unsigned char sha[20];
+        cs_sha1_ctx shaContext;
+        cs_sha1_init(&shaContext);
+        cs_sha1_update(&shaContext, reinterpret_cast<const unsigned char*>(key->p), key->len);
+        cs_sha1_update(&shaContext, reinterpret_cast<const unsigned char*>(GUID), sizeof(GUID) - 1);
+        cs_sha1_final(sha, &shaContext);
+        
+        char accept[sizeof(sha) * 2];
+        mg_base64_encode(sha, sizeof(sha), accept);
+        
+        mg_printf(nc,
+                  "HTTP/1.1 101 Switching Protocols\r\n"
+                  "Upgrade: websocket\r\n"
+                  "Connection: Upgrade\r\n"
+                  "Sec-WebSocket-Accept: %s\r\n"
+                  "Sec-WebSocket-Protocol: %s\r\n"
+                  "\r\n",
+                  accept, protocol);
+    }
+    
+    char* PrependWebSocketHeader(int op, char* payload, size_t size) {
+        // Server frames are not masked (RFC 6455, 5.1).
+        char* header;
+        
+        if (size < 126) {
+            header = payload - 2;
+            header[1] = static_cast<char>(size);
+        }
+        else if (size <= 0xFFFF) {
+            header = payload - 4;
+            header[1] = 126;
+            header[2] = static_cast<char>(size >> 8);
+            header[3] = static_cast<char>(size);
+        }
+        else {
+            header = payload - WEBSOCKET_HEADER_SIZE_MAX;
+            header[1] = 127;
+            for (int i = 0; i < 8; ++i) {
+                header[2 + i] = static_cast<char>(static_cast<uint64_t>(size) >> (56 - 8 * i));
+            }
+        }
+        
+        header[0] = static_cast<char>(0x80 | op);
+        
+        return header;
+    }
+    
+    void Broadcast(mg_mgr* mgr, const DeviceController::Command* commands, size_t count) {
+        // Frame once per protocol and append the same bytes to every subscriber.
+        // Payloads are serialized right after the room reserved for the header.
+        static char textFrame[WEBSOCKET_HEADER_SIZE_MAX + JsonSerializer::STATE_SIZE_MAX];
+        static char binaryFrame[WEBSOCKET_HEADER_SIZE_MAX + BinaryProtocol::STATE_FRAME_SIZE_MAX];
+        
+        const char* textStart = nullptr;
+        size_t textSize = 0;
+        const char* binaryStart = nullptr;
+        size_t binarySize = 0;
+        
+        for (mg_connection *c = mg_next(mgr, nullptr); c != nullptr; c = mg_next(mgr, c)) {
+            if ((c->flags & MG_F_IS_WEBSOCKET) == 0 || (c->flags & (MG_F_LISTENING | MG_F_CLOSE_IMMEDIATELY)) != 0) {
+                continue;
+            }
+            
+            if ((c->flags & MG_F_BINARY_PROTOCOL) != 0) {
+                if (nullptr == binaryStart) {
+                    char* payload = binaryFrame + WEBSOCKET_HEADER_SIZE_MAX;
+                    const size_t size = BinaryProtocol::Serialize(BinaryProtocol::DELTA_STATE, commands, count,
+                                                                  reinterpret_cast<uint8_t*>(payload), BinaryProtocol::STATE_FRAME_SIZE_MAX);
+                    binaryStart = PrependWebSocketHeader(WEBSOCKET_OP_BINARY, payload, size);
+                    binarySize = payload + size - binaryStart;
+                }
+                mg_send(c, binaryStart, binarySize);
+                BroadcastBytes.Increment(binarySize);
+            }
+            else {
+                if (nullptr == textStart) {
+                    char* payload = textFrame + WEBSOCKET_HEADER_SIZE_MAX;
+                    const size_t size = JsonSerializer::Serialize(commands, count, payload, JsonSerializer::STATE_SIZE_MAX);
+                    textStart = PrependWebSocketHeader(WEBSOCKET_OP_TEXT, payload, size);
+                    textSize = payload + size - textStart;
+                }
+                mg_send(c, textStart, textSize);
+                BroadcastBytes.Increment(textSize);
+            }
+            
+            BroadcastFrames.Increment();
         }
     }
     
@@ -107,102 +505,154 @@ namespace {
         
         switch (event) {
             case MG_EV_HTTP_REQUEST: {
-                /* Usual HTTP request - serve static files */
+                /* REST API request or usual HTTP request - serve static files */
                 struct http_message* hm = reinterpret_cast<http_message*>(eventData);
-                mg_serve_http(nc, hm, serveHttpOpts);
-                nc->flags |= MG_F_SEND_AND_CLOSE;
+                HttpRequests.Increment();
+                if (RestApi::HandleRequest(nc, hm, *deviceController) || MetricsEndpoint::HandleRequest(nc, hm) ||
+                    assetCache.Serve(nc, hm)) {
+                    break;
+                }
+                if (isWorkDirSet) {
+                    /* Files added after startup */
+                    mg_serve_http(nc, hm, serveHttpOpts);
+                    nc->flags |= MG_F_SEND_AND_CLOSE;
+                }
+                else {
+                    HttpUtils::SendResponse(nc, hm, 404, "text/plain", "Not found\n", 10);
+                }
                 break;
             }
             case MG_EV_WEBSOCKET_HANDSHAKE_DONE: {
                 /* New websocket connection. Send current state. */
-                SendUpdate(nc, deviceController->GetLastCommands());
+                nc->flags |= MG_F_COUNTED_CLIENT;
+                WebSocketClients.Add(1);
+                
+                DeviceController::Snapshot snapshot;
+                deviceController->GetSnapshot(snapshot);
+                SendUpdate(nc, snapshot.Commands.data(), snapshot.Commands.size(), BinaryProtocol::FULL_STATE);
                 break;
             }
             case MG_EV_WEBSOCKET_FRAME: {
                 /* New websocket message. Tell everybody. */
                 struct websocket_message* wm = reinterpret_cast<websocket_message*>(eventData);
+                WebSocketFrames.Increment();
                 
-                unsigned commandType(DeviceController::NOT_SET);
-                unsigned channelIdx(DeviceController::CHANNELS_NUMBER);
-                unsigned brightness(0);
+                if ((wm->flags & 0x0F) == WEBSOCKET_OP_BINARY) {
+                    DeviceController::Command commands[BinaryProtocol::MAX_RECORDS];
+                    size_t count = 0;
+                    
+                    if (BinaryProtocol::Parse(wm->data, wm->size, commands, BinaryProtocol::MAX_RECORDS, count)) {
+                        deviceController->AddCommands(commands, count);
+                    }
+                    else {
+                        TRACER_WARN(Tracer::CATEGORY_WEB, "Malformed binary frame of %u bytes.\n", static_cast<unsigned>(wm->size));
+                    }
+                    break;
+                }
                 
-                int scanResult = sscanf(reinterpret_cast<char*>(wm->data), " { %d , %d , %d }", &commandType, &channelIdx, &brightness);
-                if (scanResult == 3 && deviceController != nullptr) {
-                    deviceController->AddCommand(static_cast<DeviceController::CommandTypesEnum>(commandType), channelIdx, brightness);
+                if ((wm->flags & 0x0F) != WEBSOCKET_OP_TEXT) {
+                    break;
+                }
+                
+                DeviceController::Command commands[CommandParser::MAX_COMMANDS];
+                size_t count = 0;
+                CommandParser::Error error;
+                
+                if (CommandParser::Parse(reinterpret_cast<const char*>(wm->data), wm->size, commands, CommandParser::MAX_COMMANDS, count, error)) {
+                    deviceController->AddCommands(commands, count);
+                }
+                else {
+                    char reply[128];
+                    const size_t size = JsonSerializer::SerializeError(error.Message, error.Offset, reply, sizeof(reply));
+                    mg_send_websocket_frame(nc, WEBSOCKET_OP_TEXT, reply, size);
                 }
                 
                 break;
             }
-            case MG_EV_WEBSOCKET_HANDSHAKE_REQUEST:
+            case MG_EV_WEBSOCKET_HANDSHAKE_REQUEST: {
+                /* JSON is used unless our subprotocol is offered. Mongoose answers
+                   without a subprotocol, so the handshake is sent here to select it. */
+                struct http_message* hm = reinterpret_cast<http_message*>(eventData);
+                
+                if (IsSubprotocolOffered(mg_get_http_header(hm, "Sec-WebSocket-Protocol"), BinaryProtocol::NAME)) {
+                    nc->flags |= MG_F_BINARY_PROTOCOL;
+                    SendWebSocketHandshake(nc, hm, BinaryProtocol::NAME);
+                }
+                break;
+            }
             case MG_EV_CLOSE:
+                if ((nc->flags & MG_F_COUNTED_CLIENT) != 0) {
+                    WebSocketClients.Add(-1);
+                }
+                break;
             default:
                 break;
         }
     }
     
-    std::vector<char> SerializeToJson(const std::vector<DeviceController::Command>& commands) {
-        static const char ENTRY_TEMPLATE[] = "%s\"%u\": { \"type\":%u, \"channelIdx\":%u, \"param\":%u}%s ";
-        static const size_t PARAM_COUNT = 5U;   // id, type, channelIdx, param, separator(comma)
-        static const size_t PARAM_SIZE = 5U;    // expect not more than 5 characters in a param value
-        
-        const size_t expectedJsonSize = (sizeof(ENTRY_TEMPLATE) + PARAM_COUNT*PARAM_SIZE) * commands.size();
-        
-        std::vector<char> result(expectedJsonSize, 0);
+    void UpdatesHandler(mg_connection* nc, int event, void* eventData) {
+        if (event != MG_EV_RECV) {
+            return;
+        }
         
-        char* bufferPos = result.data();
-        size_t bufferSize = result.size();
+        DeviceController* deviceController = reinterpret_cast<DeviceController*>(nc->user_data);
         
-        bool success = true;
+        deviceUpdates.OnSignalled(nc);
         
-        for (size_t i = 0; i < commands.size(); ++i) {
-            const DeviceController::Command& command = commands[i];
-            
-            const char* leftSeparator = (0 == i) ?  "{ " : "";
-            const char* rightSeparator = (i + 1 != commands.size()) ?  "," : "}";
-            
-            int printResult = snprintf(bufferPos, bufferSize, ENTRY_TEMPLATE,
-                                       leftSeparator,
-                                       static_cast<unsigned>(command.ChannelIdx),
-                                       static_cast<unsigned>(command.Type),
-                                       static_cast<unsigned>(command.ChannelIdx),
-                                       static_cast<unsigned>(command.Param),
-                                       rightSeparator);
-            
-            if (printResult > 0 && static_cast<unsigned>(printResult) != bufferSize) {
-                bufferPos += printResult;
-                bufferSize -= printResult;
-            }
-            else {
-                success = false;
-                break;
+        DeviceController::Command command;
+        while (deviceUpdates.Pop(command)) {
+            if (DeviceController::NOT_SET == command.Type) {
+                // The write failed, so clients get the value the channel still has.
+                std::tie(command.Type, command.Param) = deviceController->GetLastCommand(command.ChannelIdx);
             }
+            broadcastAggregator.Add(command);
         }
         
-        if (!success) {
-            result.resize(0);
-            Tracer::Log("Unexpected size of update message.\n");
-        }
-        else {
-            result.resize(bufferPos - result.data());
+        if (deviceUpdates.TakeOverflow()) {
+            UpdateQueueOverflows.Increment();
+            
+            // Some completions were dropped, so the delta is incomplete.
+            DeviceController::Snapshot snapshot;
+            deviceController->GetSnapshot(snapshot);
+            for (const DeviceController::Command& channelCommand : snapshot.Commands) {
+                broadcastAggregator.Add(channelCommand);
+            }
         }
+    }
+    
+    void FlushUpdates(mg_mgr* mgr) {
+        DeviceController::Command changed[DeviceController::CHANNELS_NUMBER];
+        const size_t count = broadcastAggregator.Take(changed);
         
-        return result;
+        Broadcast(mgr, changed, count);
     }
     
-    void SendUpdate(struct mg_connection* nc, const std::vector<DeviceController::Command>& commands) {
-        std::vector<char> buffer = SerializeToJson(commands);
-        mg_send_websocket_frame(nc, WEBSOCKET_OP_TEXT, buffer.data(), buffer.size());
+    void SendUpdate(struct mg_connection* nc, const DeviceController::Command* commands, size_t count, BinaryProtocol::FrameKindEnum kind) {
+        if ((nc->flags & MG_F_BINARY_PROTOCOL) != 0) {
+            uint8_t buffer[BinaryProtocol::STATE_FRAME_SIZE_MAX];
+            const size_t size = BinaryProtocol::Serialize(kind, commands, count, buffer, sizeof(buffer));
+            mg_send_websocket_frame(nc, WEBSOCKET_OP_BINARY, buffer, size);
+            return;
+        }
+        
+        char buffer[JsonSerializer::STATE_SIZE_MAX];
+        const size_t size = JsonSerializer::Serialize(commands, count, buffer, sizeof(buffer));
+        mg_send_websocket_frame(nc, WEBSOCKET_OP_TEXT, buffer, size);
     }
     
-    void OnDeviceUpdate(struct mg_connection* netConnection, bool result, DeviceController::CommandTypesEnum type, unsigned channelIdx, unsigned param) {
-        Tracer::Log("Executed [%u] command %u at channel %u with param %u.\n",
-                    static_cast<unsigned>(result),
-                    static_cast<unsigned>(type),
-                    static_cast<unsigned>(channelIdx),
-                    static_cast<unsigned>(param));
+    void OnDeviceUpdate(DeviceUpdateQueue* updates, bool result, DeviceController::CommandTypesEnum type, unsigned channelIdx, unsigned param) {
+        TRACER_DEBUG(Tracer::CATEGORY_WEB, "Executed [%u] command %u at channel %u with param %u.\n",
+                     static_cast<unsigned>(result),
+                     static_cast<unsigned>(type),
+                     static_cast<unsigned>(channelIdx),
+                     static_cast<unsigned>(param));
         
-        std::vector<char> buffer = SerializeToJson(std::vector<DeviceController::Command> {DeviceController::Command(type, channelIdx, param)});
+        // A failed write is queued without a value, the poll thread resends the last applied one.
+        if (!result) {
+            updates->Push(DeviceController::Command(DeviceController::NOT_SET, channelIdx, 0));
+            return;
+        }
         
-        Broadcast(netConnection, buffer.data(), buffer.size());
+        updates->Push(DeviceController::Command(type, channelIdx, param));
     }   
 }
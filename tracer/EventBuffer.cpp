@@ -0,0 +1,116 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "EventBuffer.h"
+
+namespace Tracer {
+  std::atomic<EventBuffer*> EventBuffer::_first(nullptr);
+  thread_local EventBuffer::ThreadOwner EventBuffer::_threadOwner = {nullptr};
+  
+  EventBuffer::ThreadOwner::~ThreadOwner() {
+    if (Buffer != nullptr) {
+      Buffer->_isOwned.store(false, std::memory_order_release);
+    }
+  }
+  
+  EventBuffer::EventBuffer() :
+    _writePosition(0),
+    _readPosition(0),
+    _isOwned(true),
+    _next(nullptr)
+  {
+  }
+  
+  EventBuffer* EventBuffer::GetForThisThread() {
+    if (_threadOwner.Buffer != nullptr) {
+      return _threadOwner.Buffer;
+    }
+    
+    EventBuffer* buffer = _first.load(std::memory_order_acquire);
+    for (; buffer != nullptr; buffer = buffer->_next) {
+      bool isOwned = false;
+      if (buffer->_isOwned.compare_exchange_strong(isOwned, true, std::memory_order_acquire)) {
+        break;
+      }
+    }
+    
+    if (nullptr == buffer) {
+      // Buffers are never freed, the consumer may walk the list at any time.
+      buffer = new EventBuffer();
+      buffer->_next = _first.load(std::memory_order_relaxed);
+      while (!_first.compare_exchange_weak(buffer->_next, buffer, std::memory_order_release)) {
+      }
+    }
+    
+    _threadOwner.Buffer = buffer;
+    
+    return buffer;
+  }
+  
+  EventBuffer* EventBuffer::GetFirst() {
+    return _first.load(std::memory_order_acquire);
+  }
+  
+  EventBuffer* EventBuffer::GetNext() const {
+    return _next;
+  }
+  
+  bool EventBuffer::Push(uint64_t header, const uint64_t* args, unsigned count) {
+    const size_t writePosition = _writePosition.load(std::memory_order_relaxed);
+    const size_t readPosition = _readPosition.load(std::memory_order_acquire);
+    
+    if (CAPACITY - (writePosition - readPosition) < count + 1) {
+      return false;
+    }
+    
+    _words[writePosition & INDEX_MASK] = header;
+    for (unsigned i = 0; i < count; ++i) {
+      _words[(writePosition + 1 + i) & INDEX_MASK] = args[i];
+    }
+    
+    // Sequentially consistent for the consumer's sleep check, see LogRing::Commit().
+    _writePosition.store(writePosition + 1 + count, std::memory_order_seq_cst);
+    
+    return true;
+  }
+  
+  bool EventBuffer::Pop(uint64_t& header, uint64_t* args) {
+    const size_t readPosition = _readPosition.load(std::memory_order_relaxed);
+    if (_writePosition.load(std::memory_order_acquire) == readPosition) {
+      return false;
+    }
+    
+    header = _words[readPosition & INDEX_MASK];
+    
+    const unsigned count = header & ARGS_MAX;
+    for (unsigned i = 0; i < count; ++i) {
+      args[i] = _words[(readPosition + 1 + i) & INDEX_MASK];
+    }
+    
+    _readPosition.store(readPosition + 1 + count, std::memory_order_release);
+    
+    return true;
+  }
+  
+  bool EventBuffer::IsEmpty() const {
+    return _writePosition.load(std::memory_order_seq_cst) == _readPosition.load(std::memory_order_relaxed);
+  }
+}
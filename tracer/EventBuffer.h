@@ -0,0 +1,77 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef EVENTBUFFER_H
+#define EVENTBUFFER_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Tracer {
+  // Per-thread single producer, single consumer queue of binary trace events.
+  // An event is a header word (the EventFormat address with the arguments
+  // count in its low bits) followed by the raw arguments. Buffers of finished
+  // threads are handed over to new threads, so their number is bounded by
+  // the number of threads tracing at the same time.
+  class EventBuffer {
+  public:
+    static const size_t CAPACITY = 512;
+    static const unsigned ARGS_MAX = 7;
+    
+    // Registers a buffer for the calling thread on first use.
+    static EventBuffer* GetForThisThread();
+    
+    static EventBuffer* GetFirst();
+    EventBuffer* GetNext() const;
+    
+    // Owner thread only. Returns false if there is no room.
+    bool Push(uint64_t header, const uint64_t* args, unsigned count);
+    
+    // Consumer thread only. args has to have room for ARGS_MAX words.
+    bool Pop(uint64_t& header, uint64_t* args);
+    bool IsEmpty() const;
+    
+  private:
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "Capacity has to be a power of two.");
+    static const size_t INDEX_MASK = CAPACITY - 1;
+    
+    // Gives the buffer back when its thread exits.
+    struct ThreadOwner {
+      EventBuffer* Buffer;
+      ~ThreadOwner();
+    };
+    
+    EventBuffer();
+    
+    std::array<uint64_t, CAPACITY> _words;
+    std::atomic<size_t> _writePosition;
+    std::atomic<size_t> _readPosition;
+    std::atomic<bool> _isOwned;
+    EventBuffer* _next;
+    
+    static std::atomic<EventBuffer*> _first;
+    static thread_local ThreadOwner _threadOwner;
+  };
+}
+
+#endif // EVENTBUFFER_H
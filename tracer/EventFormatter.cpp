@@ -0,0 +1,190 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "EventFormatter.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace Tracer {
+  namespace {
+    const size_t SPEC_SIZE_MAX = 32;
+    
+    class Output {
+    public:
+      Output(char* buffer, size_t size) :
+        _buffer(buffer),
+        _size(size),
+        _length(0)
+      {
+        _buffer[0] = '\0';
+      }
+      
+      void Put(char c) {
+        if (_length + 1 < _size) {
+          _buffer[_length++] = c;
+          _buffer[_length] = '\0';
+        }
+      }
+      
+      template <typename T>
+      void Print(const char* spec, T value) {
+        if (_length + 1 < _size) {
+          const int length = std::snprintf(_buffer + _length, _size - _length, spec, value);
+          if (length > 0) {
+            _length += (static_cast<size_t>(length) < _size - _length) ? length : _size - _length - 1;
+          }
+        }
+      }
+      
+      size_t GetLength() const {
+        return _length;
+      }
+      
+    private:
+      char* _buffer;
+      size_t _size;
+      size_t _length;
+    };
+  }
+  
+  size_t FormatEvent(const char* format, const uint64_t* args, unsigned count, char* buffer, size_t size) {
+    if (0 == size) {
+      return 0;
+    }
+    
+    Output output(buffer, size);
+    unsigned argIdx = 0;
+    
+    while (*format != '\0') {
+      if (*format != '%') {
+        output.Put(*format++);
+        continue;
+      }
+      
+      if ('%' == format[1]) {
+        output.Put('%');
+        format += 2;
+        continue;
+      }
+      
+      // Flags, width and precision are kept, the length modifier is replaced.
+      const char* specBegin = format++;
+      format += strspn(format, "-+ #0");
+      format += strspn(format, "0123456789");
+      if ('.' == *format) {
+        ++format;
+        format += strspn(format, "0123456789");
+      }
+      
+      const size_t prefixLength = format - specBegin;
+      const char* modifier = format;
+      format += strspn(format, "hljztL");
+      const size_t modifierLength = format - modifier;
+      
+      const char conversion = *format;
+      if ('\0' == conversion || prefixLength + 4 > SPEC_SIZE_MAX) {
+        break;
+      }
+      ++format;
+      
+      const uint64_t value = (argIdx < count) ? args[argIdx] : 0;
+      ++argIdx;
+      
+      char spec[SPEC_SIZE_MAX];
+      memcpy(spec, specBegin, prefixLength);
+      
+      switch (conversion) {
+        case 'd':
+        case 'i': {
+          long long number = static_cast<int64_t>(value);
+          if (0 == modifierLength) {
+            number = static_cast<int>(value);
+          }
+          else if (1 == modifierLength && 'h' == *modifier) {
+            number = static_cast<short>(value);
+          }
+          else if (2 == modifierLength && 'h' == *modifier) {
+            number = static_cast<signed char>(value);
+          }
+          
+          memcpy(spec + prefixLength, "lld", 4);
+          output.Print(spec, number);
+          break;
+        }
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o': {
+          unsigned long long number = value;
+          if (0 == modifierLength) {
+            number = static_cast<unsigned>(value);
+          }
+          else if (1 == modifierLength && 'h' == *modifier) {
+            number = static_cast<unsigned short>(value);
+          }
+          else if (2 == modifierLength && 'h' == *modifier) {
+            number = static_cast<unsigned char>(value);
+          }
+          
+          spec[prefixLength] = 'l';
+          spec[prefixLength + 1] = 'l';
+          spec[prefixLength + 2] = conversion;
+          spec[prefixLength + 3] = '\0';
+          output.Print(spec, number);
+          break;
+        }
+        case 'c':
+          spec[prefixLength] = 'c';
+          spec[prefixLength + 1] = '\0';
+          output.Print(spec, static_cast<int>(value));
+          break;
+        case 'p':
+          output.Print("0x%llx", static_cast<unsigned long long>(value));
+          break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+          double number;
+          static_assert(sizeof(number) == sizeof(value), "Doubles are stored in 64 bit words.");
+          memcpy(&number, &value, sizeof(number));
+          
+          spec[prefixLength] = conversion;
+          spec[prefixLength + 1] = '\0';
+          output.Print(spec, number);
+          break;
+        }
+        default:
+          output.Put('(');
+          output.Put('?');
+          output.Put(')');
+          break;
+      }
+    }
+    
+    return output.GetLength();
+  }
+}
@@ -0,0 +1,36 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef EVENTFORMATTER_H
+#define EVENTFORMATTER_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Tracer {
+  // Formats a printf format with arguments captured by TRACER_EVENT. Integer
+  // conversions are narrowed as their length modifier says, %p, %c and
+  // floating point conversions are supported, strings are not captured and
+  // print as "(?)". Returns the length of the text, which is always terminated.
+  size_t FormatEvent(const char* format, const uint64_t* args, unsigned count, char* buffer, size_t size);
+}
+
+#endif // EVENTFORMATTER_H
@@ -0,0 +1,92 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include "LogRing.h"
+
+namespace Tracer {
+  // Each slot carries a sequence number (D. Vyukov's bounded queue): it equals
+  // the position when the slot is free for that position and position + 1
+  // once the record is committed.
+  LogRing::LogRing() :
+    _claimPosition(0),
+    _readPosition(0)
+  {
+    for (size_t i = 0; i < CAPACITY; ++i) {
+      _slots[i].Sequence.store(i, std::memory_order_relaxed);
+      _slots[i].Position = i;
+    }
+  }
+  
+  LogRing::Slot* LogRing::GetSlot(Record* record) {
+    return reinterpret_cast<Slot*>(reinterpret_cast<char*>(record) - offsetof(Slot, Data));
+  }
+  
+  LogRing::Record* LogRing::Claim() {
+    size_t position = _claimPosition.load(std::memory_order_relaxed);
+    
+    for (;;) {
+      Slot& slot = _slots[position & INDEX_MASK];
+      const size_t sequence = slot.Sequence.load(std::memory_order_acquire);
+      
+      if (sequence == position) {
+        if (_claimPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          slot.Position = position;
+          return &slot.Data;
+        }
+      }
+      else if (sequence < position) {
+        // The consumer hasn't released this slot yet.
+        return nullptr;
+      }
+      else {
+        position = _claimPosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  
+  void LogRing::Commit(Record* record) {
+    Slot* slot = GetSlot(record);
+    
+    // Sequentially consistent, so that a consumer going to sleep either sees it
+    // in IsEmpty() or the producer sees the consumer's sleeping flag.
+    slot->Sequence.store(slot->Position + 1, std::memory_order_seq_cst);
+  }
+  
+  LogRing::Record* LogRing::Peek() {
+    Slot& slot = _slots[_readPosition & INDEX_MASK];
+    if (slot.Sequence.load(std::memory_order_acquire) != _readPosition + 1) {
+      return nullptr;
+    }
+    
+    return &slot.Data;
+  }
+  
+  void LogRing::Release() {
+    Slot& slot = _slots[_readPosition & INDEX_MASK];
+    slot.Sequence.store(_readPosition + CAPACITY, std::memory_order_release);
+    ++_readPosition;
+  }
+  
+  bool LogRing::IsEmpty() const {
+    const Slot& slot = _slots[_readPosition & INDEX_MASK];
+    return slot.Sequence.load(std::memory_order_seq_cst) != _readPosition + 1;
+  }
+}
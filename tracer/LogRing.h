@@ -0,0 +1,73 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef LOGRING_H
+#define LOGRING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace Tracer {
+  // Bounded lock-free queue of preformatted log records. Any thread (and a
+  // signal handler) may produce, a single thread consumes. Producers format
+  // straight into the slot they claimed, so nothing is copied or allocated.
+  class LogRing {
+  public:
+    static const size_t CAPACITY = 256;
+    static const size_t TEXT_SIZE_MAX = 200;
+    
+    struct Record {
+      int Priority;
+      char Text[TEXT_SIZE_MAX];
+    };
+    
+    LogRing();
+    
+    // Any thread. Returns nullptr if the ring is full.
+    Record* Claim();
+    void Commit(Record* record);
+    
+    // Consumer thread only. Returns nullptr if the next record is not committed yet.
+    Record* Peek();
+    void Release();
+    
+    bool IsEmpty() const;
+    
+  private:
+    struct Slot {
+      std::atomic<size_t> Sequence;
+      size_t Position;
+      Record Data;
+    };
+    
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "Capacity has to be a power of two.");
+    static const size_t INDEX_MASK = CAPACITY - 1;
+    
+    static Slot* GetSlot(Record* record);
+    
+    std::array<Slot, CAPACITY> _slots;
+    std::atomic<size_t> _claimPosition;
+    size_t _readPosition;
+  };
+}
+
+#endif // LOGRING_H
@@ -0,0 +1,164 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Tracer.h"
+#include "EventFormatter.h"
+#include "TraceFile.h"
+
+namespace {
+  struct Format {
+    unsigned Level;
+    unsigned Category;
+    std::string Text;
+  };
+  
+  bool GetNumber(FILE* file, size_t size, uint64_t& value);
+  bool Decode(FILE* file);
+}
+
+int main(int argc, char **argv) {
+
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [TRACE_FILE]\n", argv[0]);
+    return 1;
+  }
+  
+  FILE* file = stdin;
+  if (2 == argc) {
+    file = fopen(argv[1], "rb");
+    if (nullptr == file) {
+      fprintf(stderr, "Failed to open %s.\n", argv[1]);
+      return 1;
+    }
+  }
+  
+  const bool result = Decode(file);
+  
+  if (file != stdin) {
+    fclose(file);
+  }
+  
+  return result ? 0 : 1;
+}
+
+namespace {
+  
+  bool GetNumber(FILE* file, size_t size, uint64_t& value) {
+    unsigned char bytes[sizeof(value)];
+    if (fread(bytes, 1, size, file) != size) {
+      return false;
+    }
+    
+    value = 0;
+    for (size_t i = 0; i < size; ++i) {
+      value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    }
+    
+    return true;
+  }
+  
+  bool Decode(FILE* file) {
+    char magic[sizeof(TraceFile::MAGIC)];
+    uint64_t version = 0;
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, TraceFile::MAGIC, sizeof(magic)) != 0 ||
+        !GetNumber(file, 1, version) || version != TraceFile::VERSION) {
+      fprintf(stderr, "Not a trace file.\n");
+      return false;
+    }
+    
+    std::vector<Format> formats;
+    char text[512];
+    
+    uint64_t recordType;
+    while (GetNumber(file, 1, recordType)) {
+      uint64_t id = 0;
+      
+      switch (recordType) {
+        case TraceFile::RECORD_FORMAT: {
+          uint64_t level = 0;
+          uint64_t category = 0;
+          uint64_t length = 0;
+          if (!GetNumber(file, 2, id) || !GetNumber(file, 1, level) || !GetNumber(file, 1, category) ||
+              !GetNumber(file, 2, length)) {
+            break;
+          }
+          
+          Format format = {static_cast<unsigned>(level), static_cast<unsigned>(category), std::string(length, '\0')};
+          if (fread(&format.Text[0], 1, length, file) != length) {
+            break;
+          }
+          
+          if (formats.size() <= id) {
+            formats.resize(id + 1);
+          }
+          formats[id] = format;
+          continue;
+        }
+        case TraceFile::RECORD_EVENT: {
+          uint64_t count = 0;
+          if (!GetNumber(file, 2, id) || !GetNumber(file, 1, count) || count > Tracer::EVENT_ARGS_MAX) {
+            break;
+          }
+          
+          uint64_t args[Tracer::EVENT_ARGS_MAX];
+          unsigned argIdx = 0;
+          while (argIdx < count && GetNumber(file, sizeof(args[0]), args[argIdx])) {
+            ++argIdx;
+          }
+          
+          if (argIdx != count || id >= formats.size()) {
+            break;
+          }
+          
+          const Format& format = formats[id];
+          Tracer::FormatEvent(format.Text.c_str(), args, argIdx, text, sizeof(text));
+          printf("%s %s: %s",
+                 Tracer::GetLevelName(static_cast<Tracer::LevelEnum>(format.Level)),
+                 Tracer::GetCategoryName(static_cast<Tracer::CategoryEnum>(format.Category)),
+                 text);
+          continue;
+        }
+        case TraceFile::RECORD_DROPPED: {
+          uint64_t count = 0;
+          if (!GetNumber(file, 4, count)) {
+            break;
+          }
+          
+          printf("-- dropped %u records --\n", static_cast<unsigned>(count));
+          continue;
+        }
+        default:
+          break;
+      }
+      
+      fprintf(stderr, "Corrupted trace file.\n");
+      return false;
+    }
+    
+    return true;
+  }
+}
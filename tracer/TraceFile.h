@@ -0,0 +1,48 @@
+/*******************************************************************************
+#                                                                              #
+# This file is part of mp710Ctrl.                                              #
+#                                                                              #
+# Copyright (C) 2015 Oleg Efremov                                              #
+#                                                                              #
+# mp710Ctrl is free software; you can redistribute it and/or modify            #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+
+#include <cstdint>
+
+// Layout of binary trace files written by the drain thread (see
+// Tracer::SetTraceFile()) and read by mp710TraceDecode. All numbers are
+// little-endian, so files from the router can be decoded on any host.
+//
+//   header:  MAGIC, VERSION (u8)
+//   format:  RECORD_FORMAT (u8), id (u16), level (u8), category (u8), length (u16), format string
+//   event:   RECORD_EVENT (u8), format id (u16), arguments count (u8), arguments (u64 each)
+//   dropped: RECORD_DROPPED (u8), count (u32)
+//
+// A format record precedes the first event which refers to it.
+namespace TraceFile {
+  const char MAGIC[] = {'M', 'P', '7', '1', '0', 'T', 'R', 'C'};
+  const uint8_t VERSION = 1;
+  
+  enum RecordTypesEnum {
+    RECORD_FORMAT = 1,
+    RECORD_EVENT = 2,
+    RECORD_DROPPED = 3
+  };
+}
+
+#endif // TRACEFILE_H
@@ -20,57 +20,545 @@
 *******************************************************************************/
 
 #include "Tracer.h"
+#include "LogRing.h"
+#include "EventBuffer.h"
+#include "EventFormatter.h"
+#include "TraceFile.h"
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstdarg> 
 #include <cstring>
+#include <atomic>
+#include <thread>
 #include <syslog.h>
 #include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <time.h>
 
 namespace Tracer {
   static const char* TraceName = "UvcStreamer"; 
   
+  std::atomic<int> MinLevels[CATEGORIES_NUMBER] = {{DEFAULT_LEVEL}, {DEFAULT_LEVEL}, {DEFAULT_LEVEL}, {DEFAULT_LEVEL}};
+  
   namespace {
+    // How often the drain thread wakes up while dropped or suppressed records
+    // wait to be reported. Otherwise it sleeps until it is woken up.
+    const int DROPS_REPORT_PERIOD_MS = 1000;
+    
+    LogRing Ring;
+    std::atomic<bool> IsAsync(false);
+    std::atomic<bool> IsDrainerSleeping(false);
+    std::atomic<bool> NeedToStopDrainer(false);
+    std::atomic<unsigned> DroppedCount(0);
+    int DrainerWakeupFd = -1;
+    std::thread DrainerThread;
+    
+    std::atomic<CallSite*> ListedCallSites(nullptr);
+    
+    // Set before StartAsync(), then used by the drain thread only.
+    FILE* TraceFileHandle = nullptr;
+    unsigned NextFormatFileId = 1;
+    
+    const char* const LEVEL_NAMES[] = {"trace", "debug", "info", "warn", "error", "none"};
+    const char* const CATEGORY_NAMES[] = {"general", "device", "usb", "web"};
+    static_assert(sizeof(LEVEL_NAMES) / sizeof(LEVEL_NAMES[0]) == LEVEL_NONE + 1, "Level names mismatch.");
+    static_assert(sizeof(CATEGORY_NAMES) / sizeof(CATEGORY_NAMES[0]) == CATEGORIES_NUMBER, "Category names mismatch.");
+    
+    int GetSysLogPriority(LevelEnum level) {
+      switch (level) {
+        case LEVEL_ERROR:
+          return LOG_ERR;
+        case LEVEL_WARN:
+          return LOG_WARNING;
+        case LEVEL_INFO:
+          return LOG_INFO;
+        default:
+          return LOG_DEBUG;
+      }
+    }
+    
+    bool FindName(const char* const names[], int count, const char* name, size_t nameLength, int& index) {
+      for (int i = 0; i < count; ++i) {
+        if (strlen(names[i]) == nameLength && strncmp(names[i], name, nameLength) == 0) {
+          index = i;
+          return true;
+        }
+      }
+      
+      return false;
+    }
+    
     bool IsStdErrReady() {
       return fileno(stderr) != -1;
     }
     
-    void LogVArgs(const char* format, va_list args) {
+    void OpenSysLog() {
+      static bool isSysLogInitialized = false;
+      if (!isSysLogInitialized) {
+        ::openlog(Tracer::TraceName, LOG_ODELAY, LOG_USER | LOG_ERR);
+        isSysLogInitialized = true;
+      }
+    }
+    
+    void WriteVArgs(int priority, const char* format, va_list args) {
       
       if (IsStdErrReady()) {
         std::vfprintf(stderr, format, args);
       }
       else {
-        static bool isSysLogInitialized = false;
-        if (!isSysLogInitialized) {
-          ::openlog(Tracer::TraceName, LOG_ODELAY, LOG_USER | LOG_ERR);
-          isSysLogInitialized = true;
+        OpenSysLog();
+        ::vsyslog(priority, format, args);
+      }
+    }
+    
+    void Write(int priority, const char* text) {
+      if (IsStdErrReady()) {
+        std::fputs(text, stderr);
+      }
+      else {
+        OpenSysLog();
+        ::syslog(priority, "%s", text);
+      }
+    }
+    
+    void WakeupDrainer() {
+      if (IsDrainerSleeping.exchange(false)) {
+        const uint64_t increment = 1;
+        // Nonblocking, an already signalled counter is just as good.
+        ssize_t ret = write(DrainerWakeupFd, &increment, sizeof(increment));
+        (void)ret;
+      }
+    }
+    
+    void Enqueue(int priority, const char* format, va_list args) {
+      LogRing::Record* record = Ring.Claim();
+      if (nullptr == record) {
+        DroppedCount.fetch_add(1, std::memory_order_relaxed);
+        WakeupDrainer();
+        return;
+      }
+      
+      record->Priority = priority;
+      const int length = std::vsnprintf(record->Text, sizeof(record->Text), format, args);
+      if (length < 0) {
+        record->Text[0] = '\0';
+      }
+      else if (static_cast<size_t>(length) >= sizeof(record->Text)) {
+        // Keep the line break of truncated records.
+        record->Text[sizeof(record->Text) - 2] = '\n';
+      }
+      
+      Ring.Commit(record);
+      WakeupDrainer();
+    }
+    
+    void LogVArgs(LevelEnum level, const char* format, va_list args) {
+      const int priority = GetSysLogPriority(level);
+      
+      if (IsAsync.load(std::memory_order_acquire)) {
+        Enqueue(priority, format, args);
+      }
+      else {
+        WriteVArgs(priority, format, args);
+      }
+    }
+    
+    void FormatAndWriteEvent(const EventFormat& format, const uint64_t* args, unsigned count) {
+      char text[LogRing::TEXT_SIZE_MAX];
+      FormatEvent(format.Format, args, count, text, sizeof(text));
+      Write(GetSysLogPriority(format.Level), text);
+    }
+    
+    void PutNumber(uint64_t value, size_t size) {
+      unsigned char bytes[sizeof(value)];
+      for (size_t i = 0; i < size; ++i) {
+        bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+      }
+      
+      std::fwrite(bytes, 1, size, TraceFileHandle);
+    }
+    
+    void PutEvent(EventFormat& format, const uint64_t* args, unsigned count) {
+      if (0 == format.FileId) {
+        format.FileId = NextFormatFileId++;
+        
+        const size_t length = strlen(format.Format);
+        PutNumber(TraceFile::RECORD_FORMAT, 1);
+        PutNumber(format.FileId, 2);
+        PutNumber(format.Level, 1);
+        PutNumber(format.Category, 1);
+        PutNumber(length, 2);
+        std::fwrite(format.Format, 1, length, TraceFileHandle);
+      }
+      
+      PutNumber(TraceFile::RECORD_EVENT, 1);
+      PutNumber(format.FileId, 2);
+      PutNumber(count, 1);
+      for (unsigned i = 0; i < count; ++i) {
+        PutNumber(args[i], sizeof(args[i]));
+      }
+    }
+    
+    void Drain() {
+      while (LogRing::Record* record = Ring.Peek()) {
+        Write(record->Priority, record->Text);
+        Ring.Release();
+      }
+      
+      uint64_t header;
+      uint64_t args[EVENT_ARGS_MAX];
+      for (EventBuffer* buffer = EventBuffer::GetFirst(); buffer != nullptr; buffer = buffer->GetNext()) {
+        while (buffer->Pop(header, args)) {
+          EventFormat& format = *reinterpret_cast<EventFormat*>(static_cast<uintptr_t>(header & ~static_cast<uint64_t>(EVENT_ARGS_MAX)));
+          const unsigned count = header & EVENT_ARGS_MAX;
+          
+          if (TraceFileHandle != nullptr) {
+            PutEvent(format, args, count);
+          }
+          else {
+            FormatAndWriteEvent(format, args, count);
+          }
         }
-
-        ::vsyslog(LOG_ERR, format, args);
       }
+      
+      if (TraceFileHandle != nullptr) {
+        std::fflush(TraceFileHandle);
+      }
+    }
+    
+    bool IsDrained() {
+      if (!Ring.IsEmpty()) {
+        return false;
+      }
+      
+      for (EventBuffer* buffer = EventBuffer::GetFirst(); buffer != nullptr; buffer = buffer->GetNext()) {
+        if (!buffer->IsEmpty()) {
+          return false;
+        }
+      }
+      
+      return true;
+    }
+    
+    void ReportDrops(unsigned& reportedCount) {
+      const unsigned droppedCount = DroppedCount.load(std::memory_order_relaxed);
+      if (droppedCount != reportedCount) {
+        char text[64];
+        std::snprintf(text, sizeof(text), "Dropped %u log records.\n", droppedCount - reportedCount);
+        Write(LOG_WARNING, text);
+        
+        if (TraceFileHandle != nullptr) {
+          PutNumber(TraceFile::RECORD_DROPPED, 1);
+          PutNumber(droppedCount - reportedCount, 4);
+          std::fflush(TraceFileHandle);
+        }
+        
+        reportedCount = droppedCount;
+      }
+    }
+    
+    uint32_t GetNowMs() {
+      // The coarse clock is read without a syscall and is precise enough here.
+      timespec now;
+      clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+      return static_cast<uint32_t>(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+    }
+    
+    void ListCallSite(CallSite& site) {
+      if (site.IsListed.exchange(true)) {
+        return;
+      }
+      
+      // Sites are static, so they are never unlisted.
+      site.Next = ListedCallSites.load(std::memory_order_relaxed);
+      while (!ListedCallSites.compare_exchange_weak(site.Next, &site, std::memory_order_release)) {
+      }
+    }
+    
+    // Starts a new window if the current one is over. Returns the number of
+    // records suppressed in the finished window.
+    uint32_t RollWindow(CallSite& site, uint32_t nowMs, bool force) {
+      uint32_t windowStartMs = site.WindowStartMs.load(std::memory_order_relaxed);
+      if (!force && nowMs - windowStartMs < RATE_LIMIT_WINDOW_MS) {
+        return 0;
+      }
+      
+      // One thread wins, the others stay in the new window.
+      if (!site.WindowStartMs.compare_exchange_strong(windowStartMs, nowMs, std::memory_order_relaxed)) {
+        return 0;
+      }
+      
+      site.PassedCount.store(0, std::memory_order_relaxed);
+      return site.SuppressedCount.exchange(0, std::memory_order_relaxed);
+    }
+    
+    void ReportSuppressed(const CallSite& site, uint32_t suppressedCount) {
+      if (0 == suppressedCount) {
+        return;
+      }
+      
+      const char* fileName = strrchr(site.File, '/');
+      fileName = (nullptr == fileName) ? site.File : fileName + 1;
+      
+      Log(site.Level, site.Category, "%s:%u: last message repeated %u times.\n",
+          fileName, site.Line, static_cast<unsigned>(suppressedCount));
+    }
+    
+    void ReportCallSites(bool force) {
+      const uint32_t nowMs = GetNowMs();
+      
+      for (CallSite* site = ListedCallSites.load(std::memory_order_acquire); site != nullptr; site = site->Next) {
+        if (site->SuppressedCount.load(std::memory_order_relaxed) != 0) {
+          ReportSuppressed(*site, RollWindow(*site, nowMs, force));
+        }
+      }
+    }
+    
+    bool HasPendingReports(unsigned reportedDropsCount) {
+      if (DroppedCount.load(std::memory_order_relaxed) != reportedDropsCount) {
+        return true;
+      }
+      
+      for (CallSite* site = ListedCallSites.load(std::memory_order_acquire); site != nullptr; site = site->Next) {
+        if (site->SuppressedCount.load(std::memory_order_relaxed) != 0) {
+          return true;
+        }
+      }
+      
+      return false;
+    }
+    
+    void DrainerThreadFunc() {
+      unsigned reportedDropsCount = DroppedCount.load();
+      
+      while (!NeedToStopDrainer) {
+        ReportCallSites(false);
+        Drain();
+        ReportDrops(reportedDropsCount);
+        
+        IsDrainerSleeping = true;
+        if (!IsDrained()) {
+          IsDrainerSleeping = false;
+          continue;
+        }
+        
+        // Checked after going to sleep, new drops and suppressions wake it up.
+        const int timeoutMs = HasPendingReports(reportedDropsCount) ? DROPS_REPORT_PERIOD_MS : -1;
+        
+        pollfd wakeupPollFd = {DrainerWakeupFd, POLLIN, 0};
+        if (poll(&wakeupPollFd, 1, timeoutMs) > 0) {
+          uint64_t counter = 0;
+          ssize_t ret = read(DrainerWakeupFd, &counter, sizeof(counter));
+          (void)ret;
+        }
+        
+        IsDrainerSleeping = false;
+      }
+      
+      ReportCallSites(true);
+      Drain();
+      ReportDrops(reportedDropsCount);
     }
   }
 
 
-  void Log(const char* format, ...) {
+  void Log(LevelEnum level, CategoryEnum category, const char* format, ...) {
+    if (!IsEnabled(level, category)) {
+      return;
+    }
+    
     va_list args;
     va_start(args, format);
-    LogVArgs(format, args);
+    LogVArgs(level, format, args);
     va_end(args);
   }
   
-  void LogErrNo(const char* format, ...) {
+  void LogErrNo(LevelEnum level, CategoryEnum category, const char* format, ...) {
+    const int errorCode = errno;
+    
+    if (!IsEnabled(level, category)) {
+      return;
+    }
+    
     va_list args;
     va_start(args, format);
-    LogVArgs(format, args);
+    LogVArgs(level, format, args);
     va_end(args);
     
     char errorMessageBuff[128] = {0};
     
-    char* errorMessage = strerror_r(errno, errorMessageBuff, sizeof(errorMessageBuff));
+    char* errorMessage = strerror_r(errorCode, errorMessageBuff, sizeof(errorMessageBuff));
     if (errorMessage != nullptr) {
-      Log("%s\n", errorMessage);
+      Log(level, category, "%s\n", errorMessage);
     }
   }
+  
+  void SetLevel(LevelEnum level) {
+    for (auto& minLevel : MinLevels) {
+      minLevel.store(level, std::memory_order_relaxed);
+    }
+  }
+  
+  void SetLevel(CategoryEnum category, LevelEnum level) {
+    MinLevels[category].store(level, std::memory_order_relaxed);
+  }
+  
+  bool SetLevels(const char* spec) {
+    while (*spec != '\0') {
+      const char* itemEnd = strchr(spec, ',');
+      if (nullptr == itemEnd) {
+        itemEnd = spec + strlen(spec);
+      }
+      
+      const char* equalSign = static_cast<const char*>(memchr(spec, '=', itemEnd - spec));
+      const char* levelName = (nullptr == equalSign) ? spec : equalSign + 1;
+      
+      int level = LEVEL_NONE;
+      if (!FindName(LEVEL_NAMES, LEVEL_NONE + 1, levelName, itemEnd - levelName, level)) {
+        return false;
+      }
+      
+      if (nullptr == equalSign) {
+        SetLevel(static_cast<LevelEnum>(level));
+      }
+      else {
+        int category = CATEGORY_GENERAL;
+        if (!FindName(CATEGORY_NAMES, CATEGORIES_NUMBER, spec, equalSign - spec, category)) {
+          return false;
+        }
+        
+        SetLevel(static_cast<CategoryEnum>(category), static_cast<LevelEnum>(level));
+      }
+      
+      spec = (*itemEnd == ',') ? itemEnd + 1 : itemEnd;
+    }
+    
+    return true;
+  }
+  
+  bool StartAsync() {
+    if (IsAsync) {
+      return true;
+    }
+    
+    DrainerWakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (DrainerWakeupFd < 0) {
+      LogErrNo(LEVEL_ERROR, CATEGORY_GENERAL, "Failed to create log wakeup event.\n");
+      return false;
+    }
+    
+    // The drain thread has to be joined on every way out of the program.
+    static bool isAtExitRegistered = false;
+    if (!isAtExitRegistered) {
+      std::atexit(StopAsync);
+      isAtExitRegistered = true;
+    }
+    
+    NeedToStopDrainer = false;
+    std::thread drainerThread(DrainerThreadFunc);
+    DrainerThread.swap(drainerThread);
+    
+    IsAsync.store(true, std::memory_order_release);
+    
+    return true;
+  }
+  
+  void StopAsync() {
+    if (!IsAsync) {
+      return;
+    }
+    
+    IsAsync.store(false, std::memory_order_release);
+    
+    NeedToStopDrainer = true;
+    IsDrainerSleeping = true;
+    WakeupDrainer();
+    DrainerThread.join();
+    
+    // Records of threads which were in the middle of Log() while stopping.
+    Drain();
+    
+    close(DrainerWakeupFd);
+    DrainerWakeupFd = -1;
+    
+    if (TraceFileHandle != nullptr) {
+      std::fclose(TraceFileHandle);
+      TraceFileHandle = nullptr;
+    }
+  }
+  
+  unsigned GetDroppedCount() {
+    return DroppedCount.load(std::memory_order_relaxed);
+  }
+  
+  bool IsAllowed(CallSite& site) {
+    const int errorCode = errno;
+    
+    ReportSuppressed(site, RollWindow(site, GetNowMs(), false));
+    
+    bool isAllowed = true;
+    if (site.PassedCount.fetch_add(1, std::memory_order_relaxed) >= RATE_LIMIT_BURST) {
+      ListCallSite(site);
+      // The drain thread has to arm its timeout to report the suppression.
+      if (0 == site.SuppressedCount.fetch_add(1, std::memory_order_relaxed)) {
+        WakeupDrainer();
+      }
+      isAllowed = false;
+    }
+    
+    errno = errorCode;
+    return isAllowed;
+  }
+  
+  const char* GetLevelName(LevelEnum level) {
+    return (level <= LEVEL_NONE) ? LEVEL_NAMES[level] : "?";
+  }
+  
+  const char* GetCategoryName(CategoryEnum category) {
+    return (category < CATEGORIES_NUMBER) ? CATEGORY_NAMES[category] : "?";
+  }
+  
+  void WriteEvent(EventFormat& format, const uint64_t* args, unsigned count) {
+    if (!IsAsync.load(std::memory_order_acquire)) {
+      FormatAndWriteEvent(format, args, count);
+      return;
+    }
+    
+    static_assert(EVENT_ARGS_MAX == EventBuffer::ARGS_MAX, "Arguments count has to fit into the header.");
+    static_assert(alignof(EventFormat) > EVENT_ARGS_MAX, "Arguments count is kept in the low bits of the format address.");
+    
+    const uint64_t header = reinterpret_cast<uintptr_t>(&format) | count;
+    if (!EventBuffer::GetForThisThread()->Push(header, args, count)) {
+      DroppedCount.fetch_add(1, std::memory_order_relaxed);
+      WakeupDrainer();
+      return;
+    }
+    
+    WakeupDrainer();
+  }
+  
+  bool SetTraceFile(const char* path) {
+    if (IsAsync) {
+      return false;
+    }
+    
+    FILE* file = std::fopen(path, "wb");
+    if (nullptr == file) {
+      LogErrNo(LEVEL_ERROR, CATEGORY_GENERAL, "Failed to open trace file %s.\n", path);
+      return false;
+    }
+    
+    if (TraceFileHandle != nullptr) {
+      std::fclose(TraceFileHandle);
+    }
+    
+    TraceFileHandle = file;
+    std::fwrite(TraceFile::MAGIC, 1, sizeof(TraceFile::MAGIC), TraceFileHandle);
+    PutNumber(TraceFile::VERSION, 1);
+    
+    return true;
+  }
 }
@@ -22,9 +22,189 @@
 #ifndef TRACER_H
 #define TRACER_H
 
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
 namespace Tracer {
-  void Log(const char* format, ...);
-  void LogErrNo(const char* format, ...);
+  enum LevelEnum {
+    LEVEL_TRACE,
+    LEVEL_DEBUG,
+    LEVEL_INFO,
+    LEVEL_WARN,
+    LEVEL_ERROR,
+    LEVEL_NONE
+  };
+  
+  enum CategoryEnum {
+    CATEGORY_GENERAL,
+    CATEGORY_DEVICE,
+    CATEGORY_USB,
+    CATEGORY_WEB,
+    CATEGORIES_NUMBER
+  };
+  
+  static const LevelEnum DEFAULT_LEVEL = LEVEL_INFO;
+  
+  // Use the TRACER_* macros below instead, they skip disabled levels before
+  // the arguments are evaluated.
+  void Log(LevelEnum level, CategoryEnum category, const char* format, ...) __attribute__((format(printf, 3, 4)));
+  // Appends strerror(errno) on a separate line.
+  void LogErrNo(LevelEnum level, CategoryEnum category, const char* format, ...) __attribute__((format(printf, 3, 4)));
+  
+  extern std::atomic<int> MinLevels[CATEGORIES_NUMBER];
+  
+  inline bool IsEnabled(LevelEnum level, CategoryEnum category) {
+    return level >= MinLevels[category].load(std::memory_order_relaxed);
+  }
+  
+  void SetLevel(LevelEnum level);
+  void SetLevel(CategoryEnum category, LevelEnum level);
+  // Parses "debug" or "info,usb=trace,web=warn" (a bare level applies to all categories).
+  bool SetLevels(const char* spec);
+  
+  // Moves output to a background thread. Log() then only formats into a
+  // lock-free ring buffer and never blocks on stderr or syslogd; records that
+  // don't fit are dropped and counted. Until StartAsync() and after StopAsync()
+  // records are written synchronously.
+  bool StartAsync();
+  // Writes out all queued records and stops the background thread. Also
+  // called at exit.
+  void StopAsync();
+  
+  unsigned GetDroppedCount();
+  
+  // Warnings and errors are limited per call site: RATE_LIMIT_BURST records
+  // pass in every RATE_LIMIT_WINDOW_MS, the rest are counted and summarized as
+  // "last message repeated N times" once the window is over.
+  static const unsigned RATE_LIMIT_BURST = 3;
+  static const unsigned RATE_LIMIT_WINDOW_MS = 10000;
+  
+  struct CallSite {
+    LevelEnum Level;
+    CategoryEnum Category;
+    const char* File;
+    unsigned Line;
+    std::atomic<uint32_t> WindowStartMs;
+    std::atomic<uint32_t> PassedCount;
+    std::atomic<uint32_t> SuppressedCount;
+    // Sites which suppressed records are listed for the drain thread.
+    std::atomic<bool> IsListed;
+    CallSite* Next;
+  };
+  
+  // Costs a clock read and a few atomic operations, so storms are cheap. Keeps errno.
+  bool IsAllowed(CallSite& site);
+  
+  const char* GetLevelName(LevelEnum level);
+  const char* GetCategoryName(CategoryEnum category);
+  
+  // Call site of a binary trace event, see TRACER_EVENT. Its address is the
+  // format id the hot path stores.
+  struct alignas(8) EventFormat {
+    LevelEnum Level;
+    CategoryEnum Category;
+    const char* Format;
+    // Assigned by the drain thread when it writes the format to a trace file.
+    unsigned FileId;
+  };
+  
+  static const unsigned EVENT_ARGS_MAX = 7;
+  
+  // Stores the raw arguments into a buffer of the calling thread, they are
+  // formatted later by the drain thread or, with a trace file, offline by
+  // mp710TraceDecode. Without StartAsync() events are formatted at once.
+  // Not for signal handlers.
+  void WriteEvent(EventFormat& format, const uint64_t* args, unsigned count);
+  
+  // Events are written to PATH instead of being formatted. Has to be called before StartAsync().
+  bool SetTraceFile(const char* path);
+  
+  template <typename T>
+  inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, uint64_t>::type ToEventArg(T value) {
+    return static_cast<uint64_t>(static_cast<int64_t>(value));
+  }
+  
+  inline uint64_t ToEventArg(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+  
+  inline uint64_t ToEventArg(const void* value) {
+    return reinterpret_cast<uintptr_t>(value);
+  }
+  
+  // Strings may be gone by the time the event is formatted.
+  uint64_t ToEventArg(const char* value) = delete;
+  
+  template <typename... Args>
+  inline void Event(EventFormat& format, Args... args) {
+    static_assert(sizeof...(Args) <= EVENT_ARGS_MAX, "Too many event arguments.");
+    const uint64_t packed[sizeof...(Args) + 1] = {ToEventArg(args)...};
+    WriteEvent(format, packed, sizeof...(Args));
+  }
+  
+  // Never called, lets the compiler check event arguments against the format.
+  inline void CheckEventFormat(const char*, ...) __attribute__((format(printf, 1, 2)));
+  inline void CheckEventFormat(const char*, ...) {
+  }
 }
 
+// Levels below TRACER_MIN_LEVEL are removed at compile time. Release builds
+// set it from CMake, see TRACER_MIN_LEVEL in the top CMakeLists.txt.
+#ifndef TRACER_MIN_LEVEL
+#define TRACER_MIN_LEVEL Tracer::LEVEL_TRACE
+#endif
+
+#define TRACER_LOG(level, category, ...) \
+  do { \
+    if ((level) >= (TRACER_MIN_LEVEL) && Tracer::IsEnabled((level), (category))) { \
+      Tracer::Log((level), (category), __VA_ARGS__); \
+    } \
+  } while (false)
+
+#define TRACER_CALL_SITE(level, category) \
+  static Tracer::CallSite callSite = {(level), (category), __FILE__, __LINE__, {0}, {0}, {0}, {false}, nullptr}
+
+#define TRACER_LOG_LIMITED(level, category, ...) \
+  do { \
+    if ((level) >= (TRACER_MIN_LEVEL) && Tracer::IsEnabled((level), (category))) { \
+      TRACER_CALL_SITE((level), (category)); \
+      if (Tracer::IsAllowed(callSite)) { \
+        Tracer::Log((level), (category), __VA_ARGS__); \
+      } \
+    } \
+  } while (false)
+
+#define TRACER_TRACE(category, ...) TRACER_LOG(Tracer::LEVEL_TRACE, category, __VA_ARGS__)
+#define TRACER_DEBUG(category, ...) TRACER_LOG(Tracer::LEVEL_DEBUG, category, __VA_ARGS__)
+#define TRACER_INFO(category, ...) TRACER_LOG(Tracer::LEVEL_INFO, category, __VA_ARGS__)
+#define TRACER_WARN(category, ...) TRACER_LOG_LIMITED(Tracer::LEVEL_WARN, category, __VA_ARGS__)
+#define TRACER_ERROR(category, ...) TRACER_LOG_LIMITED(Tracer::LEVEL_ERROR, category, __VA_ARGS__)
+
+#define TRACER_ERRNO(category, ...) \
+  do { \
+    if (Tracer::LEVEL_ERROR >= (TRACER_MIN_LEVEL) && Tracer::IsEnabled(Tracer::LEVEL_ERROR, (category))) { \
+      TRACER_CALL_SITE(Tracer::LEVEL_ERROR, (category)); \
+      if (Tracer::IsAllowed(callSite)) { \
+        Tracer::LogErrNo(Tracer::LEVEL_ERROR, (category), __VA_ARGS__); \
+      } \
+    } \
+  } while (false)
+
+// Like TRACER_LOG, but formatting is deferred: the hot path costs a few
+// stores. Arguments may be integers, enums, floating point numbers or pointers.
+#define TRACER_EVENT(level, category, format, ...) \
+  do { \
+    if ((level) >= (TRACER_MIN_LEVEL) && Tracer::IsEnabled((level), (category))) { \
+      static Tracer::EventFormat eventFormat = {(level), (category), (format), 0}; \
+      if (false) { \
+        Tracer::CheckEventFormat(format, ##__VA_ARGS__); \
+      } \
+      Tracer::Event(eventFormat, ##__VA_ARGS__); \
+    } \
+  } while (false)
+
 #endif // TRACER_H
\ No newline at end of file